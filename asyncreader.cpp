@@ -0,0 +1,304 @@
+#include "asyncreader.h"
+#include <fstream>
+#include <map>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+//an io_uring instance with its mapped rings
+struct uring{
+	int fd;
+	unsigned entries;
+	unsigned *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	io_uring_sqe *sqes;
+	io_uring_cqe *cqes;
+	void *sqRing, *cqRing;
+	size_t sqRingSize, cqRingSize, sqesSize;
+};
+
+/**
+ * Tear down a ring set up by setupRing.
+ */
+static void destroyRing(uring *r){
+	if (r->sqes != MAP_FAILED) {
+		munmap(r->sqes, r->sqesSize);
+	}
+	if (r->cqRing != MAP_FAILED && r->cqRing != r->sqRing) {
+		munmap(r->cqRing, r->cqRingSize);
+	}
+	if (r->sqRing != MAP_FAILED) {
+		munmap(r->sqRing, r->sqRingSize);
+	}
+	close(r->fd);
+	delete r;
+}
+
+/**
+ * Set up an io_uring with the given number of entries and map its rings.
+ * Return nullptr if the kernel refuses it.
+ */
+static uring *setupRing(unsigned entries){
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	uring *r = new uring();
+	r->fd = fd;
+	r->entries = p.sq_entries;
+	r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	r->sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+
+	bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) {
+		r->sqRingSize = r->cqRingSize = std::max(r->sqRingSize, r->cqRingSize);
+	}
+
+	r->sqRing = mmap(nullptr, r->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	r->cqRing = single ? r->sqRing : mmap(nullptr, r->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	r->sqes = (io_uring_sqe*)mmap(nullptr, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (r->sqRing == MAP_FAILED || r->cqRing == MAP_FAILED || r->sqes == MAP_FAILED) {
+		destroyRing(r);
+		return nullptr;
+	}
+
+	char *sq = (char*)r->sqRing;
+	r->sqTail = (unsigned*)(sq + p.sq_off.tail);
+	r->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+	r->sqArray = (unsigned*)(sq + p.sq_off.array);
+
+	char *cq = (char*)r->cqRing;
+	r->cqHead = (unsigned*)(cq + p.cq_off.head);
+	r->cqTail = (unsigned*)(cq + p.cq_off.tail);
+	r->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+	r->cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	return r;
+}
+
+/**
+ * Finish a request with blocking pread, starting after the done bytes.
+ * Used for short reads and kernels without IORING_OP_READ.
+ */
+static void finishByPread(int fd, readRequest &request, uint64_t done){
+	while (done < request.size) {
+		ssize_t n = pread(fd, &request.result[done], request.size - done, request.offset + done);
+		if (n <= 0) {
+			break;
+		}
+		done += n;
+	}
+	request.result.resize(done);
+}
+#else
+struct uring{};
+
+static void destroyRing(uring *r){
+	delete r;
+}
+
+static uring *setupRing(unsigned entries){
+	return nullptr;
+}
+#endif
+
+/**
+ * Create a reader keeping at most d reads in flight per batch.
+ * io_uring is probed once here, ring = false forces the thread pool.
+ */
+asyncReader::asyncReader(unsigned d, bool ring):depth(std::max(1u, d)),useRing(false){
+	if (ring) {
+		uring *r = setupRing(depth);
+		if (r != nullptr) {
+			idleRings.push_back(r);
+			useRing = true;
+		}
+	}
+}
+
+asyncReader::~asyncReader(){
+	for (std::vector<uring*>::iterator iter = idleRings.begin(); iter != idleRings.end(); iter++) {
+		destroyRing(*iter);
+	}
+}
+
+/**
+ * Take an idle ring, set up a new one if every ring is busy.
+ * Return nullptr if no ring can be set up any more.
+ */
+uring *asyncReader::acquire(){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!idleRings.empty()) {
+			uring *r = idleRings.back();
+			idleRings.pop_back();
+			return r;
+		}
+	}
+
+	uring *r = setupRing(depth);
+	if (r == nullptr) {
+		useRing = false;
+	}
+	return r;
+}
+
+void asyncReader::release(uring *r){
+	std::lock_guard<std::mutex> lock(mtx);
+	idleRings.push_back(r);
+}
+
+/**
+ * Read all the requests through an io_uring.
+ * Keep the submission queue full until every request is submitted,
+ * and reap completions while waiting for at least one of them.
+ */
+void asyncReader::readByRing(uring *r, std::vector<readRequest> &requests){
+#ifdef USE_IO_URING
+	std::map<fs::path, int> files;		//open each file only once
+	std::vector<int> fds;
+	for (std::vector<readRequest>::iterator iter = requests.begin(); iter != requests.end(); iter++) {
+		std::map<fs::path, int>::iterator file = files.find(iter->name);
+		if (file == files.end()) {
+			file = files.insert(std::make_pair(iter->name, open(iter->name.c_str(), O_RDONLY))).first;
+		}
+		fds.push_back(file->second);
+		iter->found = file->second >= 0;
+		iter->result.assign(iter->found ? iter->size : 0, '\0');
+	}
+
+	size_t next = 0;
+	unsigned inFlight = 0, pending = 0;
+	while (next < requests.size() || inFlight > 0) {
+		//fill the submission queue
+		while (next < requests.size() && inFlight < r->entries) {
+			if (!requests[next].found || requests[next].size == 0) {
+				next++;
+				continue;
+			}
+
+			unsigned tail = *r->sqTail;
+			unsigned position = tail & *r->sqMask;
+			io_uring_sqe *sqe = &r->sqes[position];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = fds[next];
+			sqe->addr = (uint64_t)&requests[next].result[0];
+			sqe->len = requests[next].size;
+			sqe->off = requests[next].offset;
+			sqe->user_data = next;
+			r->sqArray[position] = position;
+			__atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+			next++;
+			inFlight++;
+			pending++;
+		}
+
+		if (inFlight == 0) {
+			break;
+		}
+
+		int submitted = syscall(__NR_io_uring_enter, r->fd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+		if (submitted < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error("fail to submit reads to io_uring!");
+		}
+		pending -= submitted;
+
+		//reap completions
+		unsigned head = *r->cqHead;
+		while (head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)) {
+			io_uring_cqe *cqe = &r->cqes[head & *r->cqMask];
+			readRequest &request = requests[cqe->user_data];
+			if (cqe->res < 0 || (uint64_t)cqe->res < request.size) {
+				finishByPread(fds[cqe->user_data], request, cqe->res < 0 ? 0 : cqe->res);
+			}
+			head++;
+			inFlight--;
+		}
+		__atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	for (std::map<fs::path, int>::iterator file = files.begin(); file != files.end(); file++) {
+		if (file->second >= 0) {
+			close(file->second);
+		}
+	}
+#endif
+}
+
+/**
+ * Read all the requests on the fallback thread pool.
+ * Requests are split into one slice per worker, each slice is read
+ * with blocking reads.
+ */
+void asyncReader::readByPool(std::vector<readRequest> &requests){
+	std::shared_ptr<threadPool> workers;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (pool == nullptr) {
+			pool = std::make_shared<threadPool>(std::min(depth, 16u));
+		}
+		workers = pool;
+	}
+
+	size_t slice = (requests.size() + workers->size() - 1) / workers->size();
+	std::vector<std::future<void>> results;
+	for (size_t begin = 0; begin < requests.size(); begin += slice) {
+		size_t end = std::min(begin + slice, requests.size());
+		results.push_back(workers->submit([&requests, begin, end] {
+			for (size_t i = begin; i != end; i++) {
+				std::ifstream inFile(requests[i].name.string(), std::ios::in | std::ios::binary);
+				requests[i].found = (bool)inFile;
+				if (inFile) {
+					requests[i].result.assign(requests[i].size, '\0');
+					inFile.seekg(requests[i].offset, std::ios::beg);
+					inFile.read(&requests[i].result[0], requests[i].size);
+					requests[i].result.resize(inFile.gcount());
+				}
+			}
+		}));
+	}
+
+	for (std::vector<std::future<void>>::iterator iter = results.begin(); iter != results.end(); iter++) {
+		iter->get();
+	}
+}
+
+/**
+ * Finish all the requests of a batch before returning.
+ * Requests of files that can not be opened are left not found.
+ */
+void asyncReader::read(std::vector<readRequest> &requests){
+	if (requests.empty()) {
+		return;
+	}
+
+	uring *r = useRing ? acquire() : nullptr;
+	if (r != nullptr) {
+		try {
+			readByRing(r, requests);
+		}catch (...) {
+			destroyRing(r);
+			throw;
+		}
+		release(r);
+	}
+	else {
+		readByPool(requests);
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <filesystem>
+#include "threadpool.h"
+
+namespace fs = std::filesystem;
+
+//a read of size bytes at offset of file name
+struct readRequest{
+	fs::path name;
+	uint64_t offset, size;
+
+	std::string result;		//bytes read
+
+	bool found;		//false iff the file can not be opened
+
+	readRequest(const fs::path &n, uint64_t o, uint64_t s):name(n),offset(o),size(s),found(false){}
+};
+
+struct uring;
+
+/**
+ * Reader keeping many reads in flight at once.
+ * On Linux the reads of a batch are submitted through io_uring, where it
+ * is unavailable they are spread over a thread pool doing blocking reads.
+ */
+class asyncReader{
+
+	protected:
+		unsigned depth;		//maximum reads in flight of a batch
+		std::atomic<bool> useRing;		//whether io_uring is usable
+		std::vector<uring*> idleRings;		//rings not used by any batch
+		std::mutex mtx;		//protect idleRings and pool
+		std::shared_ptr<threadPool> pool;		//fallback workers, created on demand
+
+		uring *acquire();		//take an idle ring or set up a new one
+
+		void release(uring *r);		//give the ring back
+
+		void readByRing(uring *r, std::vector<readRequest> &requests);		//read through io_uring
+
+		void readByPool(std::vector<readRequest> &requests);		//read through thread pool
+
+	public:
+		asyncReader(unsigned d, bool ring = true);
+
+		~asyncReader();
+
+		void read(std::vector<readRequest> &requests);		//finish all the requests
+};
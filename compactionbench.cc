@@ -0,0 +1,76 @@
+#include <iostream>
+#include <random>
+#include <chrono>
+#include "kvstore.h"
+
+/**
+ * Benchmark of compaction styles.
+ * Usage: compactionbench [writes] [value size] [reads]
+ * Loads the same random writes, a quarter of them overwriting earlier
+ * keys, into a fresh store per style, then times random reads. Reports
+ * write amplification as bytes written into SSTables per byte put, and
+ * space amplification as bytes of SSTables per live byte.
+ */
+
+uint64_t diskUsage(const fs::path &dir) {
+	uint64_t result = 0;
+	for (auto &iter : fs::recursive_directory_iterator(dir)) {
+		if (iter.is_regular_file() && iter.path().parent_path().filename() != "index") {
+			result += iter.file_size();
+		}
+	}
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	int writes = argc > 1 ? atoi(argv[1]) : 200000;
+	int valueSize = argc > 2 ? atoi(argv[2]) : 1000;
+	int reads = argc > 3 ? atoi(argv[3]) : 20000;
+	uint64_t keys = writes * 3 / 4;
+
+	const char *names[] = {"leveled", "tiered"};
+	compactionStyle styles[] = {compactionStyle::leveled, compactionStyle::tiered};
+
+	for (int s = 0; s < 2; s++) {
+		fs::path dir = fs::path("data") / ("compactionbench_" + std::string(names[s]));
+		fs::remove_all(dir);
+
+		options o;
+		o.style = styles[s];
+		o.valueThreshold = valueSize + 1;		//keep values in SSTables
+		std::mt19937_64 rng(2021);
+		double writeSeconds, readMicros;
+		statistics stat;
+		uint64_t space, live = 0;
+		std::vector<bool> written(keys, false);
+		{
+			KVStore store(dir.string(), o);
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (int i = 0; i < writes; i++) {
+				uint64_t key = rng() % keys;
+				live += !written[key];
+				written[key] = true;
+				store.put(key, std::string(valueSize, 'a' + i % 26));
+			}
+			writeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			uint64_t found = 0;
+			for (int i = 0; i < reads; i++) {
+				found += !store.get(rng() % keys).empty();
+			}
+			readMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / reads;
+
+			stat = store.Stats();
+			space = diskUsage(dir);
+			std::cout << names[s] << ": " << writeSeconds << "s to write, " << readMicros << "us per read, " << found << " found" << std::endl;
+		}
+
+		double put = (double)writes * valueSize;
+		std::cout << "  write amplification " << (stat.flushBytes + stat.compactionBytes) / put << ", space amplification " << space / ((double)live * valueSize) << std::endl;
+		fs::remove_all(dir);
+	}
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include "eytzingerindex.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define USE_AVX2
+#include <immintrin.h>
+
+/**
+ * Number of keys of the node less than key, compared 4 at a time.
+ * AVX2 only compares signed integers, so the sign bits are flipped first.
+ */
+__attribute__((target("avx2")))
+static unsigned rankAVX2(const uint64_t *keys, uint64_t key){
+	const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+	__m256i x = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+	__m256i low = _mm256_xor_si256(_mm256_load_si256((const __m256i*)keys), sign);
+	__m256i high = _mm256_xor_si256(_mm256_load_si256((const __m256i*)(keys + 4)), sign);
+
+	unsigned less = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, low)));
+	less |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, high))) << 4;
+	return __builtin_popcount(less);
+}
+
+/**
+ * Whether the CPU supports AVX2, checked once on first use, as static
+ * initializers of other units may run before the CPU model is set up.
+ */
+static bool hasAVX2(){
+	static const bool result = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+	return result;
+}
+#endif
+
+/**
+ * Number of keys of the node less than key, without SIMD.
+ */
+static unsigned rankScalar(const uint64_t *keys, uint64_t key){
+	unsigned less = 0;
+	for (unsigned i = 0; i < 8; i++) {
+		less += keys[i] < key;
+	}
+	return less;
+}
+
+/**
+ * Lay out the sorted distinct keys, keys beyond the last one are padded
+ * so that every node is full.
+ */
+eytzingerIndex::eytzingerIndex(const std::vector<uint64_t> &keys):nodes((keys.size() + B - 1) / B),positions(nodes.size() * B, UINT32_MAX){
+	uint64_t t = 0;
+	build(keys, 0, t);
+}
+
+/**
+ * In-order traversal of the 9-ary tree, child i of node k is
+ * k * (B + 1) + i + 1, the t-th smallest key goes to the t-th slot visited.
+ */
+void eytzingerIndex::build(const std::vector<uint64_t> &keys, uint64_t k, uint64_t &t){
+	if (k >= nodes.size()) {
+		return;
+	}
+
+	for (unsigned i = 0; i < B; i++) {
+		build(keys, k * (B + 1) + i + 1, t);
+		if (t < keys.size()) {
+			nodes[k].keys[i] = keys[t];
+			positions[k * B + i] = t++;
+		}
+		else {
+			nodes[k].keys[i] = UINT64_MAX;
+		}
+	}
+	build(keys, k * (B + 1) + B + 1, t);
+}
+
+/**
+ * Walk down from the root, in each node take the first key not less than
+ * key as the candidate and descend to the child before it.
+ * The last candidate is the answer, its position is looked up only once.
+ * Padding sorts after every key, so it is the answer only if no key is
+ * not less than key.
+ */
+int64_t eytzingerIndex::lowerBound(uint64_t key) const{
+	const node *tree = nodes.data();
+	uint64_t count = nodes.size(), candidate = UINT64_MAX;		//slot of the last candidate
+#ifdef USE_AVX2
+	bool avx2 = hasAVX2();
+#endif
+
+	for (uint64_t k = 0; k < count;) {
+#ifdef USE_AVX2
+		unsigned i = avx2 ? rankAVX2(tree[k].keys, key) : rankScalar(tree[k].keys, key);
+#else
+		unsigned i = rankScalar(tree[k].keys, key);
+#endif
+		if (i < B) {
+			candidate = k * B + i;
+		}
+		k = k * (B + 1) + i + 1;
+	}
+
+	if (candidate == UINT64_MAX || positions[candidate] == UINT32_MAX) {
+		return -1;
+	}
+	return positions[candidate];
+}
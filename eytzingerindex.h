@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * Static B+-tree (S-tree) over the sorted keys of a SSTable.
+ * Every node is one cache line of 8 keys, nodes are laid out in
+ * Eytzinger order of a 9-ary tree so that a lookup touches one cache line
+ * per level. Keys of a node are compared at once with AVX2 where the CPU
+ * supports it.
+ */
+class eytzingerIndex{
+
+	static const unsigned B = 8;		//keys per node
+
+	//a cache line of keys
+	struct alignas(64) node{
+		uint64_t keys[B];
+	};
+
+	protected:
+		std::vector<node> nodes;		//tree in Eytzinger order, padded with UINT64_MAX
+		std::vector<uint32_t> positions;		//position of each key of nodes, UINT32_MAX for padding
+
+		void build(const std::vector<uint64_t> &keys, uint64_t k, uint64_t &t);		//fill subtree k in order
+
+	public:
+		eytzingerIndex(){}
+
+		eytzingerIndex(const std::vector<uint64_t> &keys);		//lay out the sorted keys
+
+		bool empty() const {
+			return nodes.empty();
+		}
+
+		uint64_t memoryUsage() const {		//bytes of the tree
+			return nodes.capacity() * sizeof(node) + positions.capacity() * sizeof(uint32_t);
+		}
+
+		int64_t lowerBound(uint64_t key) const;		//position of the first key not less than key, -1 if none
+};
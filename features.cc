@@ -0,0 +1,1063 @@
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+#include "test.h"
+#include "shardedkvstore.h"
+#include "sstablewriter.h"
+#include "tracer.h"
+
+// Concatenate operands onto the value
+class appendOperator : public mergeOperator {
+public:
+	std::string merge(const std::string *existing, const std::string &operand) const override
+	{
+		return existing == nullptr ? operand : *existing + operand;
+	}
+};
+
+class FeaturesTest : public Test {
+private:
+	const fs::path root;
+
+	fs::path fresh(const std::string &name)		//empty directory for a store of its own
+	{
+		fs::path dir = root / name;
+		fs::remove_all(dir);
+		return dir;
+	}
+
+	// Fill memtable with small values until it is flushed once
+	void drain(KVStore &s, uint64_t from)
+	{
+		for (uint64_t i = 0; i < 2100; ++i)
+			s.put(from + i, std::string(1024, 'd'));
+	}
+
+	// Put keys from key on until memtable is flushed as one SSTable, deleting three in four if sparse
+	void fill(KVStore &s, uint64_t key, uint64_t size, bool sparse = false)
+	{
+		uint64_t flushed = s.Stats().flushBytes;
+		for (; s.Stats().flushBytes == flushed; ++key) {
+			s.put(key, std::string(size, 'f'));
+			if (sparse && key % 4 != 0 && s.Stats().flushBytes == flushed)
+				s.del(key);
+		}
+	}
+
+	// Data files of the SSTables in level l
+	std::set<std::string> tablesAt(const fs::path &dir, int l)
+	{
+		std::set<std::string> result;
+		for (const fs::directory_entry &entry : fs::directory_iterator(dir / ("level" + std::to_string(l))))
+			if (entry.is_regular_file())
+				result.insert(entry.path().filename().string());
+		return result;
+	}
+
+	// Whether two SSTables of level l hold overlapping key ranges
+	bool overlapping(const fs::path &dir, int l)
+	{
+		std::vector<std::pair<uint64_t, uint64_t>> ranges;
+		for (const std::string &table : tablesAt(dir, l)) {
+			fs::path file = dir / ("level" + std::to_string(l)) / "index" / table;
+			if (!fs::exists(file))
+				continue;
+			std::vector<index> indexes = readIndexFile(file);
+			if (!indexes.empty())
+				ranges.push_back(std::make_pair(indexes.front().key, indexes.back().key));
+		}
+		std::sort(ranges.begin(), ranges.end());
+		for (size_t i = 1; i < ranges.size(); ++i)
+			if (ranges[i].first <= ranges[i - 1].second)
+				return true;
+		return false;
+	}
+
+	// Skip blanks of text from pos on, return whether anything is left
+	bool skipBlanks(const std::string &text, size_t &pos)
+	{
+		while (pos < text.size() && isspace(text[pos]))
+			++pos;
+		return pos < text.size();
+	}
+
+	// Skip one JSON value of text from pos on, false if it is malformed
+	bool skipJson(const std::string &text, size_t &pos)
+	{
+		if (!skipBlanks(text, pos))
+			return false;
+
+		char open = text[pos];
+		if (open == '{' || open == '[') {
+			char close = open == '{' ? '}' : ']';
+			++pos;
+			if (skipBlanks(text, pos) && text[pos] == close)
+				return ++pos, true;
+			while (true) {
+				if (open == '{' && (!skipBlanks(text, pos) || text[pos] != '"' || !skipJson(text, pos) || !skipBlanks(text, pos) || text[pos++] != ':'))
+					return false;
+				if (!skipJson(text, pos) || !skipBlanks(text, pos))
+					return false;
+				if (text[pos] == close)
+					return ++pos, true;
+				if (text[pos++] != ',')
+					return false;
+			}
+		}
+
+		if (open == '"') {
+			for (++pos; pos < text.size() && text[pos] != '"'; ++pos)
+				if (text[pos] == '\\')
+					++pos;
+			return pos++ < text.size();
+		}
+
+		for (std::string literal : {"true", "false", "null"})
+			if (text.compare(pos, literal.size(), literal) == 0)
+				return pos += literal.size(), true;
+		size_t begin = pos;
+		while (pos < text.size() && (isdigit(text[pos]) || std::string("+-.eE").find(text[pos]) != std::string::npos))
+			++pos;
+		return pos > begin;
+	}
+
+	// Deepest level holding the data file of SSTable table, -1 if none
+	int levelOf(const fs::path &dir, const std::string &table)
+	{
+		int result = -1;
+		for (int l = 0; fs::exists(dir / ("level" + std::to_string(l))); ++l)
+			if (fs::exists(dir / ("level" + std::to_string(l)) / table))
+				result = l;
+		return result;
+	}
+
+	void gc_test()
+	{
+		const uint64_t max = 256;
+		uint64_t i;
+		options o;
+		o.logFileSize = 1 << 16;
+		o.gcRatio = 0.9;
+		fs::path dir = fresh("gc");
+
+		{
+			KVStore s(dir.string(), o);
+
+			// Large values go to the value log, half of them are overwritten
+			for (i = 0; i < max; ++i)
+				s.put(i, std::string(8192, 'a'));
+			for (i = 0; i < max; i+=2)
+				s.put(i, std::string(8192, 'b'));
+
+			// Flush until the first log file is collected
+			for (i = 0; i < 16 && fs::exists(dir / "vlog" / "1.vlog"); ++i) {
+				drain(s, max + i * 2100);
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+			EXPECT(false, fs::exists(dir / "vlog" / "1.vlog"));
+
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(8192, (i & 1) ? 'a' : 'b'), s.get(i));
+		}
+
+		// Values written back by the collection survive a restart
+		{
+			KVStore s(dir.string(), o);
+			for (i = 0; i < max; ++i)
+				EXPECT(std::string(8192, (i & 1) ? 'a' : 'b'), s.get(i));
+		}
+
+		phase();
+	}
+
+	void multiget_test()
+	{
+		const uint64_t max = 1024;
+		uint64_t i;
+		fs::path dir = fresh("multiget");
+		KVStore s(dir.string());
+
+		// Half of the pairs in SSTables, the other half in memtable
+		for (i = 0; i < max / 2; ++i)
+			s.put(i, std::to_string(i));
+		drain(s, max);
+		for (i = max / 2; i < max; ++i)
+			s.put(i, std::to_string(i));
+		for (i = 0; i < max; i+=4)
+			s.del(i);
+
+		std::vector<uint64_t> keys;
+		for (i = 0; i < max; i+=3)
+			keys.push_back(i);
+		keys.push_back(max * 100);
+		std::vector<std::string> values = s.multiGet(keys);
+		EXPECT(keys.size(), values.size());
+		for (i = 0; i < keys.size() && i < values.size(); ++i) {
+			const std::string &value = values[i];
+			EXPECT((keys[i] % 4 == 0 || keys[i] >= max) ? not_found : std::to_string(keys[i]), value);
+		}
+
+		std::vector<std::pair<uint64_t, std::string>> pairs = s.scan(max / 2 - 8, max / 2 + 7);
+		EXPECT((size_t)12, pairs.size());
+		for (i = 0; i < pairs.size(); ++i) {
+			uint64_t key = max / 2 - 7 + i + i / 3;		//every fourth key is deleted
+			EXPECT(key, pairs[i].first);
+			EXPECT(std::to_string(key), pairs[i].second);
+		}
+
+		phase();
+	}
+
+	void sharded_test()
+	{
+		const uint64_t max = 4096;
+		const uint64_t region = 1ULL << 28;		//keys are spread over three ranges, below the largest key of skiplist
+		uint64_t i;
+		fs::path hashed = fresh("hashed");
+		fs::path ranged = fresh("ranged");
+
+		{
+			ShardedKVStore h(hashed.string(), 4);
+			ShardedKVStore r(ranged.string(), std::vector<uint64_t>{region, region * 2});
+
+			for (i = 0; i < max; ++i) {
+				h.put(i % 3 * region + i, std::to_string(i));
+				r.put(i % 3 * region + i, std::to_string(i));
+			}
+			for (i = 0; i < max; i+=2) {
+				EXPECT(true, h.del(i % 3 * region + i));
+				EXPECT(true, r.del(i % 3 * region + i));
+			}
+			for (i = 0; i < max; ++i) {
+				EXPECT((i & 1) ? std::to_string(i) : not_found, h.get(i % 3 * region + i));
+				EXPECT((i & 1) ? std::to_string(i) : not_found, r.get(i % 3 * region + i));
+			}
+
+			// Memtables are not persisted, fill every shard until it is flushed
+			for (i = 0; i < 3 * 3200; ++i) {
+				h.put(i % 3 * region + max + i, std::string(1024, 'd'));
+				r.put(i % 3 * region + max + i, std::string(1024, 'd'));
+			}
+		}
+
+		{
+			ShardedKVStore h(hashed.string(), 4);
+			ShardedKVStore r(ranged.string(), std::vector<uint64_t>{region, region * 2});
+			for (i = 0; i < max; ++i) {
+				EXPECT((i & 1) ? std::to_string(i) : not_found, h.get(i % 3 * region + i));
+				EXPECT((i & 1) ? std::to_string(i) : not_found, r.get(i % 3 * region + i));
+			}
+		}
+
+		phase();
+	}
+
+	// Readers never see a value of another key while one writer overwrites
+	void concurrent_test(uint64_t rowCache)
+	{
+		const uint64_t max = 1024;
+		const uint64_t rounds = 8;
+		const unsigned readers = 4;
+		uint64_t i;
+		options o;
+		o.rowCacheSize = rowCache;
+		fs::path dir = fresh("concurrent");
+		KVStore s(dir.string(), o);
+
+		for (i = 0; i < max; ++i)
+			s.put(i, std::to_string(i) + ":0");
+
+		std::atomic<bool> done(false);
+		std::atomic<uint64_t> reads(0), wrong(0);
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < readers; ++t)
+			threads.emplace_back([&s, &done, &reads, &wrong, t, max] {
+				for (uint64_t k = t; !done; k = (k * 7 + 13) % max) {
+					std::string value = s.get(k);
+					std::string prefix = std::to_string(k) + ":";
+					if (value.compare(0, prefix.size(), prefix) != 0)
+						++wrong;
+					++reads;
+				}
+			});
+
+		// Overwrites go through flushes and compactions
+		for (uint64_t r = 1; r <= rounds; ++r) {
+			for (i = 0; i < max; ++i)
+				s.put(i, std::to_string(i) + ":" + std::to_string(r) + std::string(1024, 'v'));
+		}
+		done = true;
+		for (unsigned t = 0; t < readers; ++t)
+			threads[t].join();
+
+		EXPECT((uint64_t)0, wrong.load());
+		EXPECT(true, reads.load() > 0);
+		for (i = 0; i < max; ++i)
+			EXPECT(std::to_string(i) + ":" + std::to_string(rounds) + std::string(1024, 'v'), s.get(i));
+
+		phase();
+	}
+
+	// Flushes write no faster than the I/O rate limit
+	void rate_test()
+	{
+		const uint64_t limit = 8 << 20;
+		uint64_t i;
+		options o;
+		o.ioRateLimit = limit;
+		fs::path dir = fresh("rate");
+		KVStore s(dir.string(), o);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (i = 0; i < 6; ++i)
+			drain(s, i * 2100);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		statistics stats = s.Stats();
+		EXPECT(true, stats.flushBytes >= 5 * 2097152);
+		EXPECT(true, stats.flushBytes + stats.compactionBytes <= limit * seconds + limit / 10);
+
+		phase();
+	}
+
+	void del_test()
+	{
+		const uint64_t max = 1024;
+		uint64_t i;
+		fs::path dir = fresh("del");
+
+		{
+			KVStore s(dir.string());
+
+			// Delete pairs in SSTables and in memtable
+			for (i = 0; i < max / 2; ++i)
+				s.put(i, std::to_string(i));
+			drain(s, max);
+			for (i = max / 2; i < max; ++i)
+				s.put(i, std::to_string(i));
+
+			for (i = 0; i < max; i+=2)
+				EXPECT(true, s.del(i));
+			for (i = 0; i < max; i+=2)
+				EXPECT(false, s.del(i));
+			EXPECT(false, s.del(max * 100));
+			for (i = 0; i < max; ++i)
+				EXPECT((i & 1) ? std::to_string(i) : not_found, s.get(i));
+
+			// Deletions are flushed with memtable
+			drain(s, max * 10);
+			for (i = 0; i < max; ++i)
+				EXPECT((i & 1) ? std::to_string(i) : not_found, s.get(i));
+		}
+
+		{
+			KVStore s(dir.string());
+			for (i = 0; i < max; ++i)
+				EXPECT((i & 1) ? std::to_string(i) : not_found, s.get(i));
+			EXPECT((size_t)8, s.scan(0, 15).size());
+		}
+
+		phase();
+	}
+
+	// Writes are delayed, then blocked, while level 0 piles up behind throttled compaction
+	void stall_test(bool limited)
+	{
+		const uint64_t max = 4096;
+		uint64_t i, r;
+		options o;
+		o.l0SlowdownTables = limited ? 3 : 1000;
+		o.l0StopTables = limited ? 4 : 1000;
+		o.ioRateLimit = 16 << 20;
+		fs::path dir = fresh("stall");
+		KVStore s(dir.string(), o);
+
+		for (r = 0; r < 5; ++r)
+			for (i = 0; i < max; ++i)
+				s.put(i * 7919 % max, std::to_string(r) + std::string(1024, 't'));
+
+		statistics stats = s.Stats();
+		EXPECT(limited, stats.slowdownWrites > 0);
+		EXPECT(limited, stats.slowdownMicros > 0);
+		EXPECT(limited, stats.stopWrites > 0);
+		EXPECT(limited, stats.stopMicros > 0);
+		for (i = 0; i < max; ++i)
+			EXPECT(std::to_string(r - 1) + std::string(1024, 't'), s.get(i));
+
+		phase();
+	}
+
+	void pinned_test()
+	{
+		const uint64_t max = 1024;
+		uint64_t i;
+		fs::path dir = fresh("pinned");
+		KVStore s(dir.string());
+
+		for (i = 0; i < max; ++i)
+			s.put(i, std::to_string(i));
+		s.del(0);
+
+		// Pinned from memtable, then from a SSTable
+		pinnedSlice pinned;
+		EXPECT(true, s.get(1, pinned));
+		EXPECT(std::string("1"), pinned.ToString());
+		EXPECT(false, s.get(0, pinned));
+		drain(s, max);
+		EXPECT(true, s.get(1, pinned));
+		EXPECT(std::string("1"), pinned.ToString());
+
+		// A pinned value outlives the overwrite and flush of its key
+		s.put(1, "one");
+		drain(s, max * 10);
+		EXPECT(std::string("1"), pinned.ToString());
+		EXPECT(std::string("one"), s.get(1));
+		pinned.release();
+
+		phase();
+	}
+
+	void search_test(indexSearch search, uint64_t partition)
+	{
+		const uint64_t max = 8192;
+		uint64_t i;
+		options o;
+		o.search = search;
+		o.indexPartitionEntries = partition;
+		fs::path dir = fresh("search");
+		KVStore s(dir.string(), o);
+
+		for (i = 0; i < max; ++i)
+			s.put(i * 3, std::to_string(i) + std::string(512, 's'));
+		for (i = 0; i < max; ++i) {
+			EXPECT(std::to_string(i) + std::string(512, 's'), s.get(i * 3));
+			EXPECT(not_found, s.get(i * 3 + 1));
+		}
+
+		phase();
+	}
+
+	void ttl_test()
+	{
+		const uint64_t max = 512;
+		uint64_t i;
+		fs::path dir = fresh("ttl");
+
+		{
+			KVStore s(dir.string());
+
+			// Odd keys expire a second later, even keys never do
+			for (i = 0; i < max; ++i)
+				s.put(i, std::to_string(i), (i & 1) ? 1 : 0);
+			for (i = 0; i < max; ++i)
+				EXPECT(std::to_string(i), s.get(i));
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+			for (i = 0; i < max; ++i)
+				EXPECT((i & 1) ? not_found : std::to_string(i), s.get(i));
+
+			// Expired pairs stay hidden in SSTables
+			drain(s, max);
+			for (i = 0; i < max; ++i)
+				EXPECT((i & 1) ? not_found : std::to_string(i), s.get(i));
+		}
+
+		{
+			KVStore s(dir.string());
+			for (i = 0; i < max; ++i)
+				EXPECT((i & 1) ? not_found : std::to_string(i), s.get(i));
+		}
+
+		phase();
+	}
+
+	void merge_test()
+	{
+		options o;
+		o.merger = std::make_shared<appendOperator>();
+		fs::path dir = fresh("merge");
+
+		{
+			KVStore s(dir.string(), o);
+
+			// Operands fold into a value, or into each other
+			s.put(1, "a");
+			s.merge(1, "b");
+			s.merge(2, "x");
+			s.merge(2, "y");
+			EXPECT(std::string("ab"), s.get(1));
+			EXPECT(std::string("xy"), s.get(2));
+
+			// Operands in memtable fold into values in SSTables
+			drain(s, 1000);
+			s.merge(1, "c");
+			s.merge(2, "z");
+			EXPECT(std::string("abc"), s.get(1));
+			EXPECT(std::string("xyz"), s.get(2));
+
+			// A deleted value is not folded
+			s.del(1);
+			s.merge(1, "d");
+			EXPECT(std::string("d"), s.get(1));
+			drain(s, 4000);
+			EXPECT(std::string("d"), s.get(1));
+			EXPECT(std::string("xyz"), s.get(2));
+		}
+
+		{
+			KVStore s(dir.string(), o);
+			EXPECT(std::string("d"), s.get(1));
+			EXPECT(std::string("xyz"), s.get(2));
+		}
+
+		phase();
+	}
+
+	void ingest_test()
+	{
+		const uint64_t max = 1024;
+		uint64_t i;
+		fs::path dir = fresh("ingest");
+		fs::path external = fresh("external");
+		fs::create_directories(external);
+
+		{
+			KVStore s(dir.string());
+			for (i = 0; i < max; ++i)
+				s.put(i, std::to_string(i));
+
+			// One SSTable overlapping memtable, one beyond every key
+			std::vector<fs::path> paths;
+			for (uint64_t t = 0; t < 2; ++t) {
+				paths.push_back(external / (std::to_string(t) + ".dat"));
+				SSTableWriter w(paths.back());
+				for (i = t == 0 ? max / 2 : max; i < t * max + max; ++i)
+					w.add(i, "ingested" + std::to_string(i));
+				w.finish();
+			}
+
+			// An empty SSTable is taken over too, leaving no files behind
+			paths.push_back(external / "empty.dat");
+			SSTableWriter(paths.back()).finish();
+			s.ingestFiles(paths);
+			EXPECT(false, fs::exists(paths.back()));
+			EXPECT(false, fs::exists(SSTableWriter::indexPath(paths.back())));
+
+			for (i = 0; i < max * 2; ++i)
+				EXPECT(i < max / 2 ? std::to_string(i) : "ingested" + std::to_string(i), s.get(i));
+		}
+
+		{
+			KVStore s(dir.string());
+			for (i = 0; i < max * 2; ++i)
+				EXPECT(i < max / 2 ? std::to_string(i) : "ingested" + std::to_string(i), s.get(i));
+		}
+
+		phase();
+	}
+
+	// Sequential SSTables go down by hard link, nothing is rewritten
+	void trivial_test()
+	{
+		const uint64_t runs = 16;
+		uint64_t i;
+		fs::path dir = fresh("trivial");
+		fs::path witness = root / "witness.dat";		//second link of the first SSTable
+		KVStore s(dir.string());
+
+		drain(s, 0);
+		fs::remove(witness);
+		fs::create_hard_link(dir / "level0" / "1.dat", witness);
+		for (i = 1; i < runs; ++i)
+			drain(s, i * 2100);
+		for (i = 0; i < 50 && levelOf(dir, "1.dat") < 1; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		statistics stats = s.Stats();
+		EXPECT(true, stats.flushBytes > 0);
+		EXPECT((uint64_t)0, stats.compactionBytes);
+
+		int l = levelOf(dir, "1.dat");
+		EXPECT(true, l >= 1);
+		EXPECT(true, l >= 0 && fs::equivalent(witness, dir / ("level" + std::to_string(l)) / "1.dat"));
+		for (i = 0; i < runs * 2100; i+=97)
+			EXPECT(std::string(1024, 'd'), s.get(i));
+		fs::remove(witness);
+
+		phase();
+	}
+
+	// Level 1 overflows by one SSTable, the picked one goes down to level 2
+	void pick_test(compactionPriority pick, const std::string &picked)
+	{
+		uint64_t i;
+		options o;
+		o.pick = pick;
+		o.tombstoneRatio = 0;
+		fs::path dir = fresh("pick");
+		KVStore s(dir.string(), o);
+
+		// Third SSTable is mostly deleted pairs, fourth holds its values inline
+		for (i = 1; i <= 7; ++i)
+			fill(s, i * 100000, i == 4 ? 1024 : 4096, i == 3);
+		for (i = 0; i < 50 && levelOf(dir, picked) != 2; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		for (i = 1; i <= 5; ++i) {
+			std::string table = std::to_string(i) + ".dat";
+			EXPECT(table == picked ? 2 : 1, levelOf(dir, table));
+		}
+		for (i = 1; i <= 7; ++i)
+			EXPECT(std::string(i == 4 ? 1024 : 4096, 'f'), s.get(i * 100000));
+
+		phase();
+	}
+
+	// Levels below level 0 hold sorted runs overlapping each other only in tiered style
+	void tiered_test(compactionStyle style)
+	{
+		const uint64_t max = 4096;
+		const uint64_t rounds = 8;
+		uint64_t i, r;
+		options o;
+		o.style = style;
+		fs::path dir = fresh("tiered");
+		KVStore s(dir.string(), o);
+
+		bool overlapped = false;
+		for (r = 0; r < rounds && !overlapped; ++r) {
+			for (i = 0; i < max; ++i)
+				s.put(i * 7919 % max, std::to_string(r) + std::string(1024, 't'));
+			for (i = 0; i < 50 && tablesAt(dir, 0).size() > 2; ++i)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			for (int l = 1; l < 4; ++l)
+				overlapped = overlapped || overlapping(dir, l);
+		}
+
+		EXPECT(style == compactionStyle::tiered, overlapped);
+		for (i = 0; i < max; ++i)
+			EXPECT(std::to_string(r - 1) + std::string(1024, 't'), s.get(i));
+
+		phase();
+	}
+
+	// A SSTable dense with deleted pairs is compacted before level 0 overflows
+	void dense_test(double ratio)
+	{
+		uint64_t i;
+		options o;
+		o.tombstoneRatio = ratio;
+		fs::path dir = fresh("dense");
+		KVStore s(dir.string(), o);
+
+		fill(s, 0, 4096, true);
+		for (i = 0; i < 20 && levelOf(dir, "1.dat") == 0; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		EXPECT(ratio > 0 ? -1 : 0, levelOf(dir, "1.dat"));
+		EXPECT(ratio > 0, s.Stats().compactionBytes > 0);
+		for (i = 0; i < 256; ++i)
+			EXPECT(i % 4 == 0 ? std::string(4096, 'f') : not_found, s.get(i));
+
+		phase();
+	}
+
+	// Flushes and compactions show up as complete spans of a valid Chrome trace
+	void trace_test()
+	{
+		const uint64_t max = 4096;
+		uint64_t i, r;
+		fs::path dir = fresh("trace");
+		fs::path path = root / "trace.json";
+		KVStore s(dir.string());
+
+		tracer::clear();
+		for (r = 0; r < 3; ++r)
+			for (i = 0; i < max; ++i)
+				s.put(i * 7919 % max, std::string(1024, 't'));
+		for (i = 0; i < 50 && s.Stats().compactionBytes == 0; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		EXPECT(true, s.dumpTrace(path.string()));
+
+		std::ifstream inFile(path);
+		std::stringstream content;
+		content << inFile.rdbuf();
+		std::string text = content.str();
+		size_t pos = 0;
+		EXPECT(true, skipJson(text, pos) && !skipBlanks(text, pos));
+		pos = 0;
+		EXPECT(false, skipJson(text.substr(0, text.size() / 2), pos));
+		EXPECT((size_t)0, text.find("{\"traceEvents\":["));
+		EXPECT(true, text.find("{\"name\":\"flush\",\"ph\":\"X\"") != std::string::npos);
+		EXPECT(true, text.find("{\"name\":\"compaction\",\"ph\":\"X\"") != std::string::npos);
+		EXPECT(false, s.dumpTrace((root / "missing" / "trace.json").string()));
+		fs::remove(path);
+
+		phase();
+	}
+
+	// Counters of a get tell where the value was found
+	void perf_test()
+	{
+		const uint64_t max = 1024;
+		uint64_t i;
+		fs::path dir = fresh("perf");
+		KVStore s(dir.string());
+
+		for (i = 0; i < max; ++i)
+			s.put(i, std::string(100, 'p'));
+		drain(s, max);
+		s.put(0, "memtable");
+
+		perfContext &context = perfContext::local();
+		perfContext::setLevel(perfLevel::count);
+		context.reset();
+		EXPECT(std::string("memtable"), s.get(0));
+		EXPECT((uint64_t)1, context.getCount);
+		EXPECT((uint64_t)1, context.memTableHits);
+		EXPECT((uint64_t)0, context.levelsSearched);
+		EXPECT((uint64_t)0, context.getNanos);
+
+		// From a SSTable of level 0, timed
+		perfContext::setLevel(perfLevel::time);
+		context.reset();
+		EXPECT(std::string(100, 'p'), s.get(1));
+		EXPECT((uint64_t)1, context.memTableMisses);
+		EXPECT(true, context.levelsSearched >= 1);
+		EXPECT(true, context.filterChecks >= 1);
+		EXPECT(true, context.indexSearches >= 1);
+		EXPECT(true, context.bytesRead >= 100);
+		EXPECT(true, context.getNanos > 0);
+		EXPECT(true, context.getNanos >= context.indexNanos + context.valueNanos);
+
+		// Key ranges rule out every SSTable
+		context.reset();
+		EXPECT(not_found, s.get(max * 100));
+		EXPECT(true, context.filterSkips >= 1);
+		EXPECT(context.filterChecks, context.filterSkips);
+		EXPECT((uint64_t)0, context.indexSearches);
+		EXPECT((uint64_t)0, context.bytesRead);
+
+		perfContext::setLevel(perfLevel::disabled);
+		context.reset();
+		s.get(1);
+		EXPECT((uint64_t)0, context.getCount);
+		EXPECT(std::string(), context.ToString());
+
+		phase();
+	}
+
+	// Recorded operations read back in order and replay into the same pairs
+	void record_test()
+	{
+		const uint64_t max = 256;
+		uint64_t i;
+		fs::path dir = fresh("recorded");
+		fs::path copy = fresh("replayed");
+		fs::path path = root / "workload.trace";
+		options o;
+		o.merger = std::make_shared<appendOperator>();
+
+		KVStore s(dir.string(), o);
+		s.put(max * 10, "before");
+		s.startRecording(path.string());
+		for (i = 0; i < max; ++i)
+			s.put(i, std::string(i % 16 + 1, 'r'), i % 3 == 0 ? 3600 : 0);
+		for (i = 0; i < max; i+=4)
+			s.del(i);
+		for (i = 1; i < max; i+=4)
+			s.merge(i, "m");
+		s.get(2);
+		s.scan(10, max / 2);
+		s.stopRecording();
+		s.put(max * 20, "after");
+
+		KVStore r(copy.string(), o);
+		workloadReader reader(path.string());
+		workloadOp op;
+		uint64_t ops = 0, last = 0;
+		while (reader.next(op)) {
+			EXPECT(true, op.micros >= last);
+			last = op.micros;
+			switch (op.op) {
+				case workloadOp::put:
+					EXPECT(op.key % 3 == 0 ? (uint64_t)3600 : 0, op.ttl);
+					r.put(op.key, std::string(op.size, 'r'), op.ttl);
+					break;
+				case workloadOp::del:
+					r.del(op.key);
+					break;
+				case workloadOp::merge:
+					r.merge(op.key, std::string(op.size, 'm'));
+					break;
+				case workloadOp::get:
+					EXPECT((uint64_t)2, op.key);
+					break;
+				case workloadOp::scan:
+					EXPECT((uint64_t)10, op.key);
+					EXPECT(max / 2, op.max);
+					EXPECT((uint64_t)0, op.size);
+					break;
+			}
+			++ops;
+		}
+		EXPECT(max + max / 4 + max / 4 + 2, ops);
+		EXPECT(not_found, r.get(max * 10));
+		EXPECT(not_found, r.get(max * 20));
+		for (i = 0; i < max; ++i)
+			EXPECT(s.get(i), r.get(i));
+
+		// Traces of the second version kept the max of a scan in its size
+		{
+			std::ofstream outFile(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			const char magic[8] = {'L', 'S', 'M', 'T', 'R', 'C', '0', '2'};
+			workloadOp::type scan = workloadOp::scan;
+			uint64_t fields[] = {7, 10, max / 2, 0};		//micros, key, size, ttl
+			outFile.write(magic, sizeof(magic));
+			outFile.write((char*)&fields[0], sizeof(uint64_t));
+			outFile.write((char*)&scan, sizeof(scan));
+			outFile.write((char*)&fields[1], 3 * sizeof(uint64_t));
+		}
+		workloadReader old(path.string());
+		EXPECT(true, old.next(op));
+		EXPECT(max / 2, op.max);
+		EXPECT((uint64_t)0, op.size);
+		EXPECT(false, old.next(op));
+		fs::remove(path);
+
+		phase();
+	}
+
+	// Every memtable representation serves the same workload alike
+	void memtable_test(memTableType type)
+	{
+		const uint64_t max = 2048;
+		uint64_t i;
+		options o;
+		o.memtable = type;
+		o.merger = std::make_shared<appendOperator>();
+		fs::path dir = fresh("memtable");
+
+		{
+			KVStore s(dir.string(), o);
+
+			// Keys arrive out of order and are overwritten before and after a flush
+			for (i = 0; i < max; ++i)
+				s.put(i * 7919 % max, std::to_string(i * 7919 % max));
+			for (i = 0; i < max; i+=2)
+				s.put(i, std::to_string(i) + "b");
+			drain(s, max);
+			for (i = 0; i < max; i+=3)
+				s.put(i, std::to_string(i) + "c");
+			for (i = 0; i < max; i+=5)
+				s.del(i);
+			for (i = 1; i < max; i+=7)
+				s.merge(i, "m");
+
+			std::vector<std::pair<uint64_t, std::string>> pairs = s.scan(0, max - 1);
+			std::vector<std::pair<uint64_t, std::string>> expected;
+			for (i = 0; i < max; ++i) {
+				std::string value = memtableValue(i);
+				EXPECT(value, s.get(i));
+				if (value != not_found)
+					expected.push_back(std::make_pair(i, value));
+			}
+			EXPECT(expected.size(), pairs.size());
+			EXPECT(true, pairs == expected);
+			drain(s, max * 10);
+		}
+
+		{
+			KVStore s(dir.string(), o);
+			for (i = 0; i < max; ++i)
+				EXPECT(memtableValue(i), s.get(i));
+		}
+
+		phase();
+	}
+
+	// Value of key i at the end of memtable_test
+	std::string memtableValue(uint64_t i)
+	{
+		std::string value = i % 5 == 0 ? not_found : std::to_string(i) + (i % 3 == 0 ? "c" : i % 2 == 0 ? "b" : "");
+		return i % 7 == 1 ? value + "m" : value;		//an operand on a deleted key is the whole value
+	}
+
+	void budget_test()
+	{
+		const uint64_t max = 16384;
+		const uint64_t budget = 1 << 20;
+		uint64_t i;
+		options o;
+		o.memoryBudget = budget;
+		o.rowCacheSize = 1 << 20;
+		o.indexPartitionEntries = 256;
+		fs::path dir = fresh("budget");
+		KVStore s(dir.string(), o);
+
+		// Memtable is flushed before it fills the budget, caches take the rest
+		for (i = 0; i < max; ++i) {
+			s.put(i, std::string(1024, 'b'));
+			if (i % 1024 == 0)
+				EXPECT(true, s.MemoryUsage().total() <= budget + budget / 8);
+		}
+		for (i = 0; i < max; i+=7)
+			EXPECT(std::string(1024, 'b'), s.get(i));
+
+		memoryUsage usage = s.MemoryUsage();
+		EXPECT(true, usage.memTable < budget);
+		EXPECT(true, usage.total() <= budget + budget / 8);
+
+		phase();
+	}
+
+	// A run of cold gets read once does not push hot rows out of the row cache
+	void admission_test()
+	{
+		const uint64_t hot = 32;
+		const uint64_t cold = 4096;
+		uint64_t i, r;
+		options o;
+		o.rowCacheSize = 2 * hot * (1024 + rowCache::overhead);
+		fs::path dir = fresh("admission");
+		KVStore s(dir.string(), o);
+
+		for (i = 0; i < hot + cold; ++i)
+			s.put(i, std::string(1024, 'h'));
+		drain(s, 100000);
+
+		for (r = 0; r < 8; ++r)
+			for (i = 0; i < hot; ++i)
+				s.get(i);
+		for (i = hot; i < hot + cold; ++i)
+			EXPECT(std::string(1024, 'h'), s.get(i));
+
+		perfContext &context = perfContext::local();
+		perfContext::setLevel(perfLevel::count);
+		context.reset();
+		for (i = 0; i < hot; ++i)
+			EXPECT(std::string(1024, 'h'), s.get(i));
+		EXPECT(hot, context.rowCacheHits);
+		EXPECT((uint64_t)0, context.rowCacheMisses);
+		perfContext::setLevel(perfLevel::disabled);
+
+		phase();
+	}
+
+public:
+	FeaturesTest(const std::string &dir, bool v=true) : Test(dir, v), root(dir)
+	{
+	}
+
+	void start_test(void *args = NULL) override
+	{
+		std::cout << "KVStore Features Test" << std::endl;
+
+		std::cout << "[Value Log Test]" << std::endl;
+		gc_test();
+
+		std::cout << "[Batched Read Test]" << std::endl;
+		multiget_test();
+
+		std::cout << "[Sharded Test]" << std::endl;
+		sharded_test();
+
+		std::cout << "[Concurrent Test]" << std::endl;
+		concurrent_test(0);
+		concurrent_test(1 << 20);
+
+		std::cout << "[Rate Limit Test]" << std::endl;
+		rate_test();
+
+		std::cout << "[Delete Test]" << std::endl;
+		del_test();
+
+		std::cout << "[Write Stall Test]" << std::endl;
+		stall_test(false);
+		stall_test(true);
+
+		std::cout << "[Pinned Read Test]" << std::endl;
+		pinned_test();
+
+		std::cout << "[Index Search Test]" << std::endl;
+		search_test(indexSearch::binary, 0);
+		search_test(indexSearch::learned, 0);
+		search_test(indexSearch::eytzinger, 0);
+		search_test(indexSearch::binary, 128);
+		search_test(indexSearch::learned, 128);
+		search_test(indexSearch::eytzinger, 128);
+
+		std::cout << "[TTL Test]" << std::endl;
+		ttl_test();
+
+		std::cout << "[Merge Test]" << std::endl;
+		merge_test();
+
+		std::cout << "[Ingest Test]" << std::endl;
+		ingest_test();
+
+		std::cout << "[Trivial Move Test]" << std::endl;
+		trivial_test();
+
+		std::cout << "[Compaction Priority Test]" << std::endl;
+		pick_test(compactionPriority::roundRobin, "1.dat");
+		pick_test(compactionPriority::minOverlap, "4.dat");
+		pick_test(compactionPriority::tombstones, "3.dat");
+
+		std::cout << "[Compaction Style Test]" << std::endl;
+		tiered_test(compactionStyle::leveled);
+		tiered_test(compactionStyle::tiered);
+
+		std::cout << "[Tombstone Compaction Test]" << std::endl;
+		dense_test(0);
+		dense_test(0.5);
+
+		std::cout << "[Trace Test]" << std::endl;
+		trace_test();
+
+		std::cout << "[Perf Context Test]" << std::endl;
+		perf_test();
+
+		std::cout << "[Workload Record Test]" << std::endl;
+		record_test();
+
+		std::cout << "[Memtable Test]" << std::endl;
+		memtable_test(memTableType::skipList);
+		memtable_test(memTableType::tree);
+		memtable_test(memTableType::vector);
+		memtable_test(memTableType::hash);
+
+		std::cout << "[Memory Budget Test]" << std::endl;
+		budget_test();
+
+		std::cout << "[Row Cache Admission Test]" << std::endl;
+		admission_test();
+
+		report();
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+
+	std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+	std::cout << "  -v: print extra info for failed tests [currently ";
+	std::cout << (verbose ? "ON" : "OFF")<< "]" << std::endl;
+	std::cout << std::endl;
+	std::cout.flush();
+
+	FeaturesTest test("./data", verbose);
+
+	test.start_test();
+
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <set>
+#include "level.h"
+
+/**
+ * Microbenchmark of SSTable index search.
+ * Usage: indexbench [tables] [keys per table] [lookups]
+ * Builds the same tables for every search method and times random
+ * lookups, half of them for absent keys. Tables together should exceed
+ * the cache to see the effect of cache misses.
+ */
+
+std::vector<std::vector<index>> makeTables(int tables, int keys, std::mt19937_64 &rng) {
+	std::vector<std::vector<index>> result;
+
+	for (int t = 0; t < tables; t++) {
+		std::set<uint64_t> distinct;
+		while ((int)distinct.size() < keys) {
+			distinct.insert(rng());
+		}
+
+		std::vector<index> indexes;
+		for (std::set<uint64_t>::iterator iter = distinct.begin(); iter != distinct.end(); iter++) {
+			indexes.push_back(index(*iter, 0, 0, t, 0));
+		}
+		result.push_back(indexes);
+	}
+
+	return result;
+}
+
+int64_t test_for_search(const std::vector<std::unique_ptr<IndexTable>> &tables, const std::vector<std::pair<int, uint64_t>> &lookups, double &nanos) {
+	int64_t checksum = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (std::vector<std::pair<int, uint64_t>>::const_iterator iter = lookups.begin(); iter != lookups.end(); iter++) {
+		index result;
+		checksum += tables[iter->first]->search(iter->second, result) ? result.key % 1024 : -1;
+	}
+	nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups.size();
+
+	return checksum;
+}
+
+int main(int argc, char *argv[]) {
+	int tables = argc > 1 ? atoi(argv[1]) : 256;
+	int keys = argc > 2 ? atoi(argv[2]) : 20000;
+	int count = argc > 3 ? atoi(argv[3]) : 4000000;
+
+	std::mt19937_64 rng(2021);
+	std::vector<std::vector<index>> indexes = makeTables(tables, keys, rng);
+
+	std::vector<std::pair<int, uint64_t>> lookups;
+	for (int i = 0; i < count; i++) {
+		int t = rng() % tables;
+		lookups.push_back(std::make_pair(t, i % 2 ? indexes[t][rng() % keys].key : rng()));
+	}
+
+	const char *names[] = {"binary", "learned", "eytzinger"};
+	indexSearch methods[] = {indexSearch::binary, indexSearch::learned, indexSearch::eytzinger};
+	int64_t expected = 0;
+
+	for (int m = 0; m < 3; m++) {
+		std::vector<std::unique_ptr<IndexTable>> built;
+		for (int t = 0; t < tables; t++) {
+			built.emplace_back(new IndexTable(indexes[t], "", methods[m]));
+		}
+
+		double nanos;
+		int64_t checksum = test_for_search(built, lookups, nanos);
+		if (m == 0) {
+			expected = checksum;
+		}
+
+		std::cout << names[m] << ": " << nanos << "ns per lookup" << (checksum == expected ? "" : " (MISMATCH)") << std::endl;
+	}
+
+	return 0;
+}
@@ -1,8 +1,9 @@
 #include "kvstore.h"
+#include "tracer.h"
 #include <string>
 
 //constructor
-KVStore::KVStore(const std::string &dir): KVStoreAPI(dir),ptrToMemTable(std::make_shared<memTable>()),storage(dir),ptrToLevelTable(std::make_shared<std::list<level>>()), SizeOfMemTable(0){
+KVStore::KVStore(const std::string &dir, const options &o): KVStoreAPI(dir),ptrToMemTable(makeMemTable(o.memtable)),storage(dir),ptrToLevelTable(std::make_shared<std::list<level>>()), SizeOfMemTable(0), opt(o), sequence(0), nextFile(1), stopping(false), delayDebt(0), slowdownWrites(0), slowdownMicros(0), stopWrites(0), stopMicros(0), flushBytes(0), compactionBytes(0), indexBytes(0), recording(false){
 	try{
 		if (!fs::exists(storage)) {
 			if (!fs::create_directory(storage)) {
@@ -10,13 +11,24 @@ KVStore::KVStore(const std::string &dir): KVStoreAPI(dir),ptrToMemTable(std::mak
 			}
 		}
 
+		vlog = std::make_shared<valueLog>(storage / "vlog", opt.logFileSize);
+		pool = std::make_shared<threadPool>(std::max(1u, opt.compactionThreads));
+		reader = std::make_shared<asyncReader>(opt.readQueueDepth, opt.useIoUring);
+		limiter = std::make_shared<rateLimiter>(opt.ioRateLimit, opt.autoTuneRateLimit);
+		if (opt.indexPartitionEntries != 0) {
+			partitions = std::make_shared<partitionCache>(opt.indexCacheSize);
+		}
+		if (opt.rowCacheSize != 0) {
+			rows = std::make_shared<rowCache>(opt.rowCacheSize);
+		}
+
 		for (int i = 9; i >= 0; i--) {
 			fs::path Level = fs::path(dir) / ("level" + std::to_string(i));
 			if (ptrToLevelTable->empty()) {
-				ptrToLevelTable->push_front(level(i,Level, pow(2, i + 1), 0));
+				ptrToLevelTable->push_front(level(i,Level, pow(2, i + 1), 0, nullptr, this));
 			}
 			else {
-				ptrToLevelTable->push_front(level(i,Level, pow(2, i + 1), 0, &(*ptrToLevelTable->begin())));
+				ptrToLevelTable->push_front(level(i,Level, pow(2, i + 1), 0, &(*ptrToLevelTable->begin()), this));
 			}
 
 			if (!fs::exists(Level)) {
@@ -28,26 +40,104 @@ KVStore::KVStore(const std::string &dir): KVStoreAPI(dir),ptrToMemTable(std::mak
 				ptrToLevelTable->front().restoreIndex();
 			}
 		}
+
+		publish();
+		compactor = std::thread(&KVStore::compactInBackground, this);
 	}catch(const std::exception &e){
 		std::cerr << e.what() << std::endl;
 		exit(1);
 	}
 }
 
-KVStore::~KVStore(){}
+//stop background compaction, a running one is finished first
+KVStore::~KVStore(){
+	{
+		std::lock_guard<std::mutex> lock(workMutex);
+		stopping = true;
+	}
+	workCond.notify_all();
+	compactor.join();
+}
 
 /**
  * Insert/Update the key-value pair.
  * No return values for simplicity.
  */
 void KVStore::put(uint64_t key, const std::string &s){
+	put(key, s, 0);
+}
+
+/**
+ * Insert/Update the key-value pair expiring ttl seconds later, a ttl of
+ * 0 never expires. An expired pair reads as not found and is dropped by
+ * compaction without any delete.
+ */
+void KVStore::put(uint64_t key, const std::string &s, uint64_t ttl){
+	record(workloadOp::put, key, s.size(), ttl);
 	try{
-		putIntoMemTable(key, s);
-		SizeOfMemTable += s.size();
+		std::unique_lock<std::mutex> writeLock(writeMutex);
+		delayWrite(s.size(), writeLock);
+
+		{
+			std::unique_lock<std::shared_mutex> memLock(memMutex);
+			putIntoMemTable(key, s, ttl == 0 ? 0 : (uint64_t)time(nullptr) + ttl);
+			SizeOfMemTable += s.size();
+		}
 
 		if(MemTableIsFull()){
 			transfer();
 		}
+		fitCache();
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+}
+
+/**
+ * Apply operand to the value of the given key through the registered
+ * merge operator, without looking the value up.
+ * A value in memtable is updated at once, otherwise the operand is kept
+ * in memtable and folded into older values by reads and compaction.
+ * If no merge operator is registered, it exits.
+ */
+void KVStore::merge(uint64_t key, const std::string &operand){
+	record(workloadOp::merge, key, operand.size());
+	try{
+		if (opt.merger == nullptr) {
+			throw std::runtime_error("no merge operator is registered!");
+		}
+
+		std::unique_lock<std::mutex> writeLock(writeMutex);
+		delayWrite(operand.size(), writeLock);
+
+		{
+			std::unique_lock<std::shared_mutex> memLock(memMutex);
+			const std::string *position = findInMemTable(key);
+			std::string value = operand;
+			uint64_t expire = 0;
+			bool isOperand = true;
+
+			if (position != nullptr) {
+				if (expiredInMemTable(key) || deletedInMemTable(key)) {		//older values are shadowed
+					value = opt.merger->merge(nullptr, operand);
+					isOperand = false;
+				}
+				else {
+					value = opt.merger->merge(position, operand);
+					isOperand = operandInMemTable(key);
+					expire = expireInMemTable(key);
+				}
+			}
+
+			putIntoMemTable(key, value, expire, isOperand);
+			SizeOfMemTable += value.size();
+		}
+
+		if(MemTableIsFull()){
+			transfer();
+		}
+		fitCache();
 	}catch(const std::exception &e){
 		std::cerr << e.what() << std::endl;
 		exit(1);
@@ -57,42 +147,472 @@ void KVStore::put(uint64_t key, const std::string &s){
 /**
  * Returns the (string) value of the given key.
  * An empty string indicates not found.
+ * Memtable is searched before pinning a version, since flush publishes
+ * the new SSTable before clearing memtable. If the value log file is
+ * collected under the pinned version, the live value has been written
+ * back to memtable, so the lookup starts over.
+ * A merge operand is folded with the older entries of the key.
+ * A value missing from memtable is looked for in the row cache before
+ * the levels, and offered to it once read from them.
  */
 std::string KVStore::get(uint64_t key){
-	node *position = findInMemTable(key);		//try to find pair in memtable
+	TRACE_SPAN(span, "slowGet", -1, opt.slowGetMicros);
+	PERF_TIMER(timer, getNanos);
+	PERF_COUNT(getCount, 1);
+	record(workloadOp::get, key, 0);
+	return lookup(key);
+}
 
-	if(position != nullptr){					//the pair is in memtable
-		return (position->data).second;
-	}
+/**
+ * Look up the value of the given key for get and the other reads, which
+ * are recorded and traced by themselves.
+ */
+std::string KVStore::lookup(uint64_t key){
+	for (int attempt = 0; attempt < 3; attempt++) {
+		std::string pending;		//operand found in memtable
+		bool folding = false;
+		uint64_t ticket = rows == nullptr ? 0 : rows->ticket(key);		//taken before memtable, which writers update before erasing
+		{
+			PERF_TIMER(memTimer, memTableNanos);
+			std::shared_lock<std::shared_mutex> memLock(memMutex);
+			const std::string *position = findInMemTable(key);		//try to find pair in memtable
+			memTimer.stop();
 
-	//try to find pair in each level(from level0)
-	for(std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end();iter++){		
-		std::string result = iter->get(key);
-		if(result != ""){
-			return result;
+			if(position == nullptr){
+				PERF_COUNT(memTableMisses, 1);
+			}
+			else{					//the pair is in memtable
+				PERF_COUNT(memTableHits, 1);
+				if(expiredInMemTable(key)){
+					return "";
+				}
+				if(!operandInMemTable(key)){
+					return *position;
+				}
+				pending = *position;
+				folding = true;
+			}
+		}
+
+		if(!folding && rows != nullptr){
+			std::shared_ptr<const std::string> cached = rows->find(key);
+			if(cached != nullptr){
+				PERF_COUNT(rowCacheHits, 1);
+				return *cached;
+			}
+			PERF_COUNT(rowCacheMisses, 1);
+		}
+
+		std::shared_ptr<const version> v = pin();
+		std::string result;
+		if(folding){
+			if(foldOperands(key, &pending, *v, result)){
+				return result;
+			}
+			continue;
+		}
+
+		//try to find pair in each level(from level0)
+		for(std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end();iter++){
+			fs::path name;
+			index i;
+			if(iter->find(*v->levels[iter->Order()], key, i, &name)){
+				if(i.dead()){
+					return "";
+				}
+
+				if(i.operand){
+					if(foldOperands(key, nullptr, *v, result)){
+						return result;
+					}
+					break;
+				}
+
+				bool found;
+				result = iter->readValue(i, name, &found);
+				if(found){
+					if(rows != nullptr && !result.empty()){
+						rows->insert(key, result, i.expire, ticket);
+					}
+					return result;
+				}
+				break;
+			}
+		}
+
+		if (v == pin()) {
+			return "";
 		}
 	}
 
 	return "";
 }
 
+/**
+ * Pin the value of the given key into value, return false iff not found.
+ * A value in SSTable or value log is viewed in the mapped file, without
+ * any copy, and stays valid after the SSTable is compacted away or the
+ * log file collected. A memtable entry may be overwritten at any moment,
+ * so it is copied once into memory owned by the slice, and so is a value
+ * folded from merge operands. A value in the row cache is shared with it.
+ */
+bool KVStore::get(uint64_t key, pinnedSlice &value){
+	TRACE_SPAN(span, "slowGet", -1, opt.slowGetMicros);
+	PERF_TIMER(timer, getNanos);
+	PERF_COUNT(getCount, 1);
+	record(workloadOp::get, key, 0);
+	value.release();
+
+	for (int attempt = 0; attempt < 3; attempt++) {
+		bool folding = false;
+		uint64_t ticket = rows == nullptr ? 0 : rows->ticket(key);
+		{
+			PERF_TIMER(memTimer, memTableNanos);
+			std::shared_lock<std::shared_mutex> memLock(memMutex);
+			const std::string *position = findInMemTable(key);
+			memTimer.stop();
+
+			if(position == nullptr){
+				PERF_COUNT(memTableMisses, 1);
+			}
+			else{
+				PERF_COUNT(memTableHits, 1);
+				if(expiredInMemTable(key)){
+					return false;
+				}
+
+				if(!operandInMemTable(key)){
+					std::shared_ptr<const std::string> copy = std::make_shared<const std::string>(*position);
+					value = pinnedSlice(*copy, copy);
+					return !copy->empty();
+				}
+				folding = true;
+			}
+		}
+
+		if(!folding && rows != nullptr){
+			std::shared_ptr<const std::string> cached = rows->find(key);
+			if(cached != nullptr){
+				PERF_COUNT(rowCacheHits, 1);
+				value = pinnedSlice(*cached, cached);
+				return true;
+			}
+			PERF_COUNT(rowCacheMisses, 1);
+		}
+
+		std::shared_ptr<const version> v = pin();
+
+		for(std::list<level>::iterator iter = ptrToLevelTable->begin(); !folding && iter != ptrToLevelTable->end();iter++){
+			std::shared_ptr<const IndexTable> table;
+			index i;
+			if(iter->find(*v->levels[iter->Order()], key, i, nullptr, &table)){
+				if(i.dead()){
+					return false;
+				}
+
+				if(i.operand){
+					folding = true;
+					break;
+				}
+
+				bool found;
+				value = iter->pinValue(i, *table, &found);
+				if(found){
+					if(rows != nullptr && !value.value().empty()){
+						rows->insert(key, value.value(), i.expire, ticket);
+					}
+					return !value.value().empty();
+				}
+				break;
+			}
+		}
+
+		if(folding){
+			std::shared_ptr<const std::string> copy = std::make_shared<const std::string>(lookup(key));
+			value = pinnedSlice(*copy, copy);
+			return !copy->empty();
+		}
+
+		if (v == pin()) {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Returns the values of the given keys, in the same order.
+ * Keys are located first, then the values found in SSTables and value
+ * log are read as one batch. An empty string indicates not found.
+ * Keys with merge operands are looked up one by one afterwards.
+ */
+std::vector<std::string> KVStore::multiGet(const std::vector<uint64_t> &keys){
+	for (std::vector<uint64_t>::const_iterator key = keys.begin(); key != keys.end(); key++) {
+		record(workloadOp::get, *key, 0);
+	}
+
+	std::vector<std::string> result(keys.size());
+	std::vector<bool> inMemTable(keys.size(), false);
+	std::vector<std::pair<index, fs::path>> reads;
+	std::vector<size_t> positions;			//position in result of each read
+	std::vector<size_t> folds;			//position in result of each key to fold
+
+	{
+		std::shared_lock<std::shared_mutex> memLock(memMutex);
+		for (size_t k = 0; k < keys.size(); k++) {
+			const std::string *position = findInMemTable(keys[k]);
+			if (position != nullptr) {
+				result[k] = expiredInMemTable(keys[k]) ? "" : *position;
+				inMemTable[k] = true;
+				if (operandInMemTable(keys[k]) && !expiredInMemTable(keys[k])) {
+					folds.push_back(k);
+				}
+			}
+		}
+	}
+
+	std::shared_ptr<const version> v = pin();
+	for (size_t k = 0; k < keys.size(); k++) {
+		if (inMemTable[k]) {
+			continue;
+		}
+
+		for (std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
+			fs::path name;
+			index i;
+			if (iter->find(*v->levels[iter->Order()], keys[k], i, &name)) {
+				if (i.operand && !i.dead()) {
+					folds.push_back(k);
+				}
+				else if (!i.dead()) {
+					reads.push_back(std::make_pair(i, name));
+					positions.push_back(k);
+				}
+				break;
+			}
+		}
+	}
+
+	std::vector<std::string> values = readValues(reads);
+	for (size_t r = 0; r < values.size(); r++) {
+		//a separated value reads empty only if its log file was collected meanwhile
+		result[positions[r]] = (reads[r].first.inLog && values[r].empty()) ? lookup(keys[positions[r]]) : values[r];
+	}
+
+	for (std::vector<size_t>::iterator k = folds.begin(); k != folds.end(); k++) {
+		result[*k] = lookup(keys[*k]);
+	}
+
+	return result;
+}
+
+/**
+ * Returns all the pairs whose key is in [min, max], sorted by key.
+ * The latest index of each key is collected from memtable and every
+ * level, then values are read as one batch. Keys with merge operands
+ * are looked up one by one afterwards.
+ */
+std::vector<std::pair<uint64_t, std::string>> KVStore::scan(uint64_t min, uint64_t max){
+	record(workloadOp::scan, min, 0, 0, max);
+	std::map<uint64_t, std::string> memPairs;
+	std::vector<uint64_t> folds;			//keys to fold
+	{
+		std::shared_lock<std::shared_mutex> memLock(memMutex);
+		ptrToMemTable->range(min, max, [this, &memPairs, &folds](uint64_t key, const std::string &value) {
+			bool expired = expiredInMemTable(key);
+			memPairs.insert(std::make_pair(key, expired ? "" : value));		//an expired pair still shadows older ones
+			if (!expired && operandInMemTable(key)) {
+				folds.push_back(key);
+			}
+		});
+	}
+
+	std::shared_ptr<const version> v = pin();
+	std::map<uint64_t, std::pair<index, fs::path>> found;
+	for (std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
+		iter->range(*v->levels[iter->Order()], min, max, found);
+	}
+
+	std::vector<std::pair<index, fs::path>> reads;
+	for (std::map<uint64_t, std::pair<index, fs::path>>::iterator iter = found.begin(); iter != found.end(); iter++) {
+		if (!iter->second.first.dead() && memPairs.find(iter->first) == memPairs.end()) {
+			if (iter->second.first.operand) {
+				folds.push_back(iter->first);
+			}
+			else {
+				reads.push_back(iter->second);
+			}
+		}
+	}
+
+	std::vector<std::string> values = readValues(reads);
+	for (size_t r = 0; r < values.size(); r++) {
+		std::string value = (reads[r].first.inLog && values[r].empty()) ? lookup(reads[r].first.key) : values[r];
+		if (value != "") {
+			memPairs.insert(std::make_pair(reads[r].first.key, value));
+		}
+	}
+
+	for (std::vector<uint64_t>::iterator key = folds.begin(); key != folds.end(); key++) {
+		memPairs[*key] = lookup(*key);
+	}
+
+	std::vector<std::pair<uint64_t, std::string>> result;
+	for (std::map<uint64_t, std::string>::iterator iter = memPairs.begin(); iter != memPairs.end(); iter++) {
+		if (iter->second != "") {
+			result.push_back(*iter);
+		}
+	}
+
+	return result;
+}
+
 /**
  * Delete the given key-value pair if it exists.
  * Return false iff the key is not found.
+ * A deleted pair is put into memtable like a write, shadowing older
+ * pairs of the key, and flushed as a deleted index. Compaction drops it
+ * once no older pair is left below. An expired pair counts as not found.
+ * The key is looked up in memtable and the latest version only, so a
+ * running compaction is never waited for.
  */
 bool KVStore::del(uint64_t key){
-	if(findInMemTable(key) != nullptr){
-		deleteInMemTable(key);
+	record(workloadOp::del, key, 0);
+	try{
+		std::unique_lock<std::mutex> writeLock(writeMutex);
+		delayWrite(sizeof(index), writeLock);
+		bool found = false;
+
+		if(findInMemTable(key) != nullptr){
+			found = !expiredInMemTable(key) && !deletedInMemTable(key);
+		}
+		else{
+			std::shared_ptr<const version> v = pin();
+			for (std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
+				index i;
+				if (iter->find(*v->levels[iter->Order()], key, i)) {
+					found = !i.dead();
+					break;
+				}
+			}
+		}
+
+		if (!found) {
+			return false;
+		}
+
+		{
+			std::unique_lock<std::shared_mutex> memLock(memMutex);
+			putTombstone(key);
+		}
+
+		if(MemTableIsFull()){
+			transfer();
+		}
+		fitCache();
 		return true;
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		exit(1);
 	}
+}
 
-	for (std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
-		if (iter->del(key)) {
-			return true;
+/**
+ * Take over the SSTables built by SSTableWriter at paths, without
+ * rewriting their values. Their pairs are newer than any pair written
+ * before. Each SSTable goes to the deepest level having room where
+ * neither that level nor any level above holds keys in its range, or to
+ * level 0 if there is no such level. Memtable pairs in range of any
+ * SSTable are flushed first, as memtable is searched before levels.
+ * Overflowing levels are compacted afterwards. SSTables without pairs
+ * are removed along with their index files.
+ * If the SSTables are invalid or overlap each other, it exits.
+ */
+void KVStore::ingestFiles(const std::vector<fs::path> &paths){
+	try{
+		std::lock_guard<std::mutex> compactionLock(compactionMutex);		//levels must stay put while SSTables are placed, taken before writeMutex as by the compactor
+		std::lock_guard<std::mutex> writeLock(writeMutex);
+		TRACE_SPAN(span, "ingestFiles");
+		TRACE_ARG(span, tables, paths.size());
+
+		std::vector<std::pair<fs::path, std::vector<index>>> tables;
+		std::vector<fs::path> empties;		//SSTables without pairs, removed once the others are placed
+		for (std::vector<fs::path>::const_iterator iter = paths.begin(); iter != paths.end(); iter++) {
+			if (!fs::exists(*iter)) {
+				throw std::runtime_error("fail to open " + iter->string() + "!");
+			}
+
+			uint64_t dataSize = fs::file_size(*iter);
+			std::vector<index> indexes = readIndexFile(SSTableWriter::indexPath(*iter));
+			for (size_t i = 0; i < indexes.size(); i++) {
+				if ((i != 0 && indexes[i].key <= indexes[i - 1].key) || indexes[i].offset + indexes[i].size > dataSize) {
+					throw std::runtime_error(iter->string() + " is not a valid SSTable!");
+				}
+			}
+
+			if (!indexes.empty()) {
+				tables.push_back(std::make_pair(*iter, indexes));
+			}
+			else {
+				empties.push_back(*iter);
+			}
 		}
-	}
 
-	return false;
+		std::sort(tables.begin(), tables.end(), [](const std::pair<fs::path, std::vector<index>> &a, const std::pair<fs::path, std::vector<index>> &b) {
+			return a.second.front().key < b.second.front().key;
+		});
+		for (size_t t = 1; t < tables.size(); t++) {
+			if (tables[t].second.front().key <= tables[t - 1].second.back().key) {
+				throw std::runtime_error("ingested SSTables overlap each other!");
+			}
+		}
+
+		bool overlapped = false;
+		for (std::vector<std::pair<fs::path, std::vector<index>>>::iterator table = tables.begin(); table != tables.end() && !overlapped; table++) {
+			ptrToMemTable->range(table->second.front().key, table->second.back().key, [&overlapped](uint64_t key, const std::string &value) { overlapped = true; });
+		}
+		if (overlapped) {
+			transfer();
+		}
+
+		for (std::vector<std::pair<fs::path, std::vector<index>>>::iterator table = tables.begin(); table != tables.end(); table++) {
+			uint64_t min = table->second.front().key, max = table->second.back().key;
+			std::list<level>::iterator target = ptrToLevelTable->begin(), roomy = ptrToLevelTable->end();
+			for (std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end() && !iter->overlaps(min, max); iter++) {
+				target = iter;
+				if (iter->Size() < iter->Capacity()) {
+					roomy = iter;
+				}
+			}
+
+			(roomy != ptrToLevelTable->end() ? roomy : target)->ingestTable(table->first, table->second, ++sequence);
+			fs::remove(SSTableWriter::indexPath(table->first));
+		}
+		for (std::vector<fs::path>::iterator iter = empties.begin(); iter != empties.end(); iter++) {
+			fs::remove(SSTableWriter::indexPath(*iter));
+			fs::remove(*iter);
+		}
+		publish();
+		if (rows != nullptr) {		//ingested pairs shadow cached values
+			rows->clear();
+		}
+
+		for (std::list<level>::iterator iter = ++ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
+			while (iter->Size() > iter->Capacity()) {
+				iter->compaction();
+			}
+		}
+		vlog->sync();
+
+		if (compactionNeeded()) {
+			std::lock_guard<std::mutex> lock(workMutex);
+			workCond.notify_one();
+		}
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
 }
 
 /**
@@ -100,28 +620,492 @@ bool KVStore::del(uint64_t key){
  * including memtable and all sstables files.
  */
 void KVStore::reset(){
+	std::lock_guard<std::mutex> writeLock(writeMutex);
+	std::unique_lock<std::shared_mutex> memLock(memMutex);
 	ptrToMemTable->clear();			//clear memtable
+	expiries.clear();
+	operands.clear();
+	tombstones.clear();
+	SizeOfMemTable = 0;
+	if (rows != nullptr) {
+		rows->clear();
+	}
+}
+
+/**
+ * Publish the SSTables of every level as a new version.
+ * Called by the writer after each change of level metadata, readers
+ * holding an older version keep using it until they finish. The rate
+ * limiter is tuned by the backlog of the new version.
+ */
+void KVStore::publish(){
+	std::shared_ptr<version> v = std::make_shared<version>();
+	v->levels.resize(ptrToLevelTable->size());
+	v->pendingBytes = 0;
+	uint64_t bytes = 0;
+
+	std::lock_guard<std::mutex> lock(levelMutex);
+	for (std::list<level>::iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
+		v->levels[iter->Order()] = iter->Tables();
+		for (TableList::const_iterator table = iter->Tables()->begin(); table != iter->Tables()->end(); table++) {
+			bytes += (*table)->memoryUsage();
+		}
+
+		if (iter->Tables()->size() > iter->Capacity()) {
+			for (TableList::const_iterator table = iter->Tables()->begin(); table != iter->Tables()->end(); table++) {
+				v->pendingBytes += (*table)->bytes;
+			}
+		}
+	}
+
+	std::atomic_store(&current, std::shared_ptr<const version>(v));
+	indexBytes = bytes;
+	limiter->tune(std::max((double)v->levels[0]->size() / std::max(1u, opt.l0StopTables), (double)v->pendingBytes / std::max<uint64_t>(1, opt.stopPendingBytes)));
 }
 
 /**
  * Transfers memtable to SSTable.
  * It removes all pairs in memtable and add a SSTable in level 0, register
- * infomation on index system. If level 0 overflows, then do compaction.
+ * infomation on index system. If level 0 overflows, or a SSTable gets over
+ * the tombstone ratio, wake up background compaction.
  */
 void KVStore::transfer(){
 	try {
-		addSSTable(ptrToMemTable->pairList(), &(ptrToLevelTable->front())); 	//add SSTable to level0
+		TRACE_SPAN(span, "flush", 0);
+		TRACE_ARG(span, bytes, SizeOfMemTable);
+		addSSTable(*ptrToMemTable, &(ptrToLevelTable->front())); 	//add SSTable to level0
+		publish();
 
-		if (ptrToLevelTable->front().Size() > ptrToLevelTable->front().Capacity()) {					//if overflow, do compaction
-			ptrToLevelTable->front().compaction();
-		}
+		{
+			std::unique_lock<std::shared_mutex> memLock(memMutex);
+			ptrToMemTable->clear();		//clear memtable
+			expiries.clear();
+			operands.clear();
+			tombstones.clear();
 
-		ptrToMemTable->clear();		//clear memtable
+			SizeOfMemTable = 0;
+		}
 
-		SizeOfMemTable = 0;
+		if (compactionNeeded() || deletionNeeded() || garbageNeeded()) {
+			std::lock_guard<std::mutex> lock(workMutex);
+			workCond.notify_one();
+		}
 	}catch (const std::exception &e) {
 		std::cout << e.what() << std::endl;
 		exit(1);
 	}
 }
 
+/**
+ * Return a SSTable of tables whose share of deleted pairs reaches the
+ * tombstone ratio, or nullptr if there is none or the ratio is 0.
+ */
+std::shared_ptr<const IndexTable> KVStore::denseTable(const TableList &tables) const{
+	if (opt.tombstoneRatio <= 0) {
+		return nullptr;
+	}
+
+	for (TableList::const_iterator iter = tables.begin(); iter != tables.end(); iter++) {
+		if ((*iter)->deleted != 0 && (*iter)->deleted >= opt.tombstoneRatio * (*iter)->count) {
+			return *iter;
+		}
+	}
+
+	return nullptr;
+}
+
+/**
+ * Whether a sealed value log file has fallen below the live ratio.
+ */
+bool KVStore::garbageNeeded() const{
+	return !vlog->garbageFiles(opt.gcRatio).empty();
+}
+
+/**
+ * Whether a level above the bottom level holds a SSTable over the
+ * tombstone ratio in the latest version. The bottom level has nowhere
+ * to compact into.
+ */
+bool KVStore::deletionNeeded() const{
+	std::shared_ptr<const version> v = pin();
+	for (size_t l = 0; l + 1 < v->levels.size(); l++) {
+		if (denseTable(*v->levels[l]) != nullptr) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Loop of the compactor thread.
+ * Compact level 0 whenever it overflows, otherwise compact a SSTable
+ * over the tombstone ratio, otherwise collect sparse value log files,
+ * and wake up writes blocked by the hard limits after each round.
+ */
+void KVStore::compactInBackground(){
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(workMutex);
+			workCond.wait(lock, [this] { return stopping || compactionNeeded() || deletionNeeded() || garbageNeeded(); });
+			if (stopping) {
+				return;
+			}
+		}
+
+		try {
+			std::lock_guard<std::mutex> lock(compactionMutex);
+			if (compactionNeeded()) {
+				ptrToLevelTable->front().compaction();
+			}
+			else if (deletionNeeded()) {
+				std::shared_ptr<const version> v = pin();		//level 0 is swapped by flush meanwhile, read it through the published version
+				for (std::list<level>::iterator iter = ptrToLevelTable->begin(); &*iter != &ptrToLevelTable->back(); iter++) {
+					std::shared_ptr<const IndexTable> table = denseTable(*v->levels[iter->Order()]);
+					if (table != nullptr) {
+						iter->compaction(table);
+						break;
+					}
+				}
+			}
+			else {
+				collectGarbage();
+			}
+			vlog->sync();		//persist garbage found by compaction
+		}catch (const std::exception &e) {
+			std::cout << e.what() << std::endl;
+			exit(1);
+		}
+
+		std::lock_guard<std::mutex> lock(workMutex);
+		stallCond.notify_all();
+	}
+}
+
+/**
+ * Slow down or block a write of bytes while compaction falls behind.
+ * Beyond the hard limits on level 0 SSTables or pending compaction bytes
+ * the write waits for compaction, with writeLock released meanwhile. Beyond the soft limits it is delayed
+ * at a rate falling from delayedWriteRate as the backlog approaches the
+ * hard limits, the delay is accumulated and slept in 1ms steps at least.
+ */
+void KVStore::delayWrite(uint64_t bytes, std::unique_lock<std::mutex> &writeLock){
+	std::shared_ptr<const version> v = pin();
+	uint64_t tables = v->levels[0]->size();
+
+	if (tables >= opt.l0StopTables || v->pendingBytes >= opt.stopPendingBytes) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		writeLock.unlock();		//the compactor may need writeMutex to make progress
+		{
+			std::unique_lock<std::mutex> lock(workMutex);
+			stallCond.wait(lock, [this] {
+				std::shared_ptr<const version> latest = pin();
+				return stopping || (latest->levels[0]->size() < opt.l0StopTables && latest->pendingBytes < opt.stopPendingBytes);
+			});
+		}
+		writeLock.lock();
+		stopWrites++;
+		stopMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		return;
+	}
+
+	if (tables < opt.l0SlowdownTables && v->pendingBytes < opt.slowdownPendingBytes) {
+		delayDebt = 0;
+		return;
+	}
+
+	//how far the backlog goes from the soft limits to the hard limits
+	double tableRatio = ((double)tables - opt.l0SlowdownTables) / std::max(1.0, (double)opt.l0StopTables - opt.l0SlowdownTables);
+	double byteRatio = ((double)v->pendingBytes - opt.slowdownPendingBytes) / std::max(1.0, (double)opt.stopPendingBytes - opt.slowdownPendingBytes);
+	double rate = opt.delayedWriteRate * std::max(0.1, 1 - std::max(tableRatio, byteRatio));
+
+	slowdownWrites++;
+	delayDebt += bytes * 1e9 / std::max(1.0, rate);
+	if (delayDebt >= 1000000) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(delayDebt));
+		slowdownMicros += delayDebt / 1000;
+		delayDebt = 0;
+	}
+}
+
+/**
+ * Return the counters since the store is opened.
+ */
+statistics KVStore::Stats() const{
+	statistics result;
+	result.slowdownWrites = slowdownWrites;
+	result.slowdownMicros = slowdownMicros;
+	result.stopWrites = stopWrites;
+	result.stopMicros = stopMicros;
+	result.flushBytes = flushBytes;
+	result.compactionBytes = compactionBytes;
+	return result;
+}
+
+/**
+ * Return the bytes held in memory by memtable, the index tables of the
+ * latest version and the caches.
+ */
+memoryUsage KVStore::MemoryUsage(){
+	memoryUsage result;
+	{
+		std::shared_lock<std::shared_mutex> memLock(memMutex);
+		result.memTable = memTableBytes();
+	}
+	result.indexTables = indexBytes;
+	result.indexCache = partitions == nullptr ? 0 : partitions->Usage();
+	result.rowCache = rows == nullptr ? 0 : rows->Usage();
+	return result;
+}
+
+/**
+ * Whether memtable and index tables together reach the memory budget,
+ * so that memtable should be flushed. A memtable under a sixteenth of
+ * the budget is kept, as flushing it would only add small SSTables
+ * while index tables alone fill the budget.
+ * Called by the writer, which is the only one modifying memtable.
+ */
+bool KVStore::overBudget() const{
+	if (opt.memoryBudget == 0) {
+		return false;
+	}
+
+	uint64_t memTable = memTableBytes();
+	return memTable >= opt.memoryBudget / 16 && memTable + indexBytes >= opt.memoryBudget;
+}
+
+/**
+ * Give the caches the room memtable and index tables leave in the memory
+ * budget, each up to its configured size, the index cache first. Cached
+ * entries are evicted if the room shrinks. Called by the writer after
+ * each write.
+ */
+void KVStore::fitCache(){
+	if (opt.memoryBudget == 0) {
+		return;
+	}
+
+	uint64_t used = memTableBytes() + indexBytes;
+	uint64_t room = used < opt.memoryBudget ? opt.memoryBudget - used : 0;
+	if (partitions != nullptr) {
+		uint64_t size = std::min(opt.indexCacheSize, room);
+		partitions->setCapacity(size);
+		room -= size;
+	}
+	if (rows != nullptr) {
+		rows->setCapacity(std::min(opt.rowCacheSize, room));
+	}
+}
+
+/**
+ * Write the spans traced so far by every thread into path, in the Chrome
+ * trace format. Tracing is shared by all the stores of the process.
+ * Return false if fail to write path.
+ */
+bool KVStore::dumpTrace(const std::string &path) const{
+	return tracer::dump(path);
+}
+
+/**
+ * Record every put, get, del, merge and scan from now on into a workload
+ * trace file at path, replacing the trace being recorded if any. A
+ * multiGet is recorded as gets of its keys.
+ * If fail to create the file, it exits.
+ */
+void KVStore::startRecording(const std::string &path){
+	try{
+		std::unique_ptr<workloadRecorder> next(new workloadRecorder(path));
+		std::lock_guard<std::mutex> lock(recordMutex);
+		if (recorder != nullptr) {
+			recorder->finish();
+		}
+		recorder = std::move(next);
+		recording = true;
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+}
+
+/**
+ * Finish the workload trace being recorded, if any.
+ * If fail to write the file, it exits.
+ */
+void KVStore::stopRecording(){
+	try{
+		std::lock_guard<std::mutex> lock(recordMutex);
+		recording = false;
+		if (recorder != nullptr) {
+			recorder->finish();
+			recorder.reset();
+		}
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+}
+
+/**
+ * Collect value log files whose live ratio is low.
+ * A value is live iff the latest index of its key still points to it,
+ * or it is to be folded into by newer merge operands. Live values are
+ * written back through memtable, which is flushed before the file is
+ * removed, as memtable does not survive a restart. A value under
+ * operands is written back folded with them, as the key's value.
+ * Called by the compactor holding compactionMutex, writeMutex is taken
+ * for each value only, so writes are never held behind a compaction.
+ */
+void KVStore::collectGarbage(){
+	std::vector<uint32_t> files = vlog->garbageFiles(opt.gcRatio);
+	if (files.empty()) {
+		return;
+	}
+
+	TRACE_SPAN(span, "collectGarbage");
+
+	for (std::vector<uint32_t>::iterator file = files.begin(); file != files.end(); file++) {
+		bool relocated = false;		//live values of the file wait in memtable
+		vlog->scan(*file, [this, file, &relocated](uint64_t key, uint64_t offset, const std::string &value) {
+			std::lock_guard<std::mutex> writeLock(writeMutex);		//no write slips between the check and the write back
+			std::string pending;		//operand in memtable
+			bool folding = false;
+			const std::string *position = findInMemTable(key);
+			if (position != nullptr) {
+				if (!operandInMemTable(key) || expiredInMemTable(key)) {			//shadowed by a newer pair
+					return;
+				}
+				pending = *position;
+				folding = true;
+			}
+
+			std::shared_ptr<const version> v = pin();
+			std::vector<std::pair<index, fs::path>> entries = history(key, *v);
+			for (std::vector<std::pair<index, fs::path>>::iterator iter = entries.begin(); iter != entries.end(); iter++) {
+				const index &i = iter->first;
+				if (i.dead()) {
+					return;
+				}
+
+				if (i.inLog && i.logFile == *file && i.offset == offset) {
+					std::string live = value;
+					uint64_t expire = i.expire;
+					if (folding || i.operand || iter != entries.begin()) {
+						if (!foldOperands(key, folding ? &pending : nullptr, *v, live)) {
+							return;
+						}
+						expire = 0;
+					}
+
+					{
+						std::unique_lock<std::shared_mutex> memLock(memMutex);
+						putIntoMemTable(key, live, expire);
+						SizeOfMemTable += live.size();
+					}
+					relocated = true;
+					if (MemTableIsFull()) {
+						transfer();
+						relocated = false;
+					}
+					return;
+				}
+
+				if (!i.operand) {		//older values are shadowed
+					return;
+				}
+			}
+		});
+
+		if (relocated) {		//the file may go only once its live values are in SSTables
+			std::lock_guard<std::mutex> writeLock(writeMutex);
+			transfer();
+		}
+		vlog->drop(*file);
+	}
+}
+
+/**
+ * Read the values the indexs refer to through the async reader.
+ * The path is the SSTable of each index, separated values are read from
+ * the value log instead. If fail to open SSTable, throw run_time error.
+ */
+std::vector<std::string> KVStore::readValues(const std::vector<std::pair<index, fs::path>> &l){
+	std::vector<readRequest> requests;
+	for (std::vector<std::pair<index, fs::path>>::const_iterator iter = l.begin(); iter != l.end(); iter++) {
+		const index &i = iter->first;
+		requests.push_back(readRequest(i.inLog ? vlog->filePath(i.logFile) : iter->second, i.offset, i.size));
+	}
+
+	reader->read(requests);
+
+	std::vector<std::string> result;
+	for (size_t r = 0; r < requests.size(); r++) {
+		if (l[r].first.inLog) {
+			result.push_back(requests[r].result);
+		}
+		else if (!requests[r].found) {
+			throw std::runtime_error("fail to open SSTable!");
+		}
+		else {
+			result.push_back(std::string(requests[r].result.c_str()));
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Return all the indexs of key in every level of version v with the path
+ * of their SSTables, the newest first.
+ */
+std::vector<std::pair<index, fs::path>> KVStore::history(uint64_t key, const version &v) const{
+	std::vector<std::pair<index, fs::path>> result;
+	for (std::list<level>::const_iterator iter = ptrToLevelTable->begin(); iter != ptrToLevelTable->end(); iter++) {
+		iter->findAll(*v.levels[iter->Order()], key, result);
+	}
+	std::sort(result.begin(), result.end(), [](const std::pair<index, fs::path> &a, const std::pair<index, fs::path> &b) {
+		return a.first.sequence > b.first.sequence;
+	});
+	return result;
+}
+
+/**
+ * Apply the merge operands of key to its value as seen in version v.
+ * pending is the operand found in memtable, or nullptr if the latest
+ * index of key is an operand. All the indexs of key in every level are
+ * applied from the newest one, until a value or a deleted pair is met.
+ * The value is put into result, which is empty if the key is deleted
+ * and no operand is applied.
+ * Return false if a value log file is collected meanwhile.
+ * If no merge operator is registered, throw run_time error.
+ */
+bool KVStore::foldOperands(uint64_t key, const std::string *pending, const version &v, std::string &result){
+	PERF_TIMER(timer, foldNanos);
+	if (opt.merger == nullptr) {
+		throw std::runtime_error("no merge operator is registered!");
+	}
+
+	std::vector<std::pair<index, fs::path>> entries = history(key, v);
+	bool folding = pending != nullptr;
+	std::string operand = folding ? *pending : "";
+	for (std::vector<std::pair<index, fs::path>>::iterator iter = entries.begin(); iter != entries.end(); iter++) {
+		if (iter->first.dead()) {
+			break;
+		}
+
+		bool found;
+		std::string value = ptrToLevelTable->front().readValue(iter->first, iter->second, &found);
+		if (!found) {
+			return false;
+		}
+
+		if (!iter->first.operand) {
+			result = folding ? opt.merger->merge(&value, operand) : value;
+			return true;
+		}
+		operand = folding ? opt.merger->merge(&value, operand) : value;
+		folding = true;
+	}
+
+	result = folding ? opt.merger->merge(nullptr, operand) : "";
+	return true;
+}
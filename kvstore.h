@@ -1,51 +1,240 @@
 #pragma once
 
 #include <math.h>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 #include "level.h"
+#include "options.h"
+#include "valuelog.h"
+#include "threadpool.h"
+#include "asyncreader.h"
+#include "ratelimiter.h"
+#include "sstablewriter.h"
+#include "workloadtrace.h"
+#include "rowcache.h"
 #include "kvstore_api.h"
-#include "skiplist.h"
+#include "memtable.h"
+
+//SSTables of every level seen by readers at one moment, never modified once published
+struct version{
+	std::vector<std::shared_ptr<const TableList>> levels;
+
+	uint64_t pendingBytes;		//bytes of the levels over capacity, to be rewritten by compaction
+};
+
+//counters reported by KVStore::Stats
+struct statistics{
+	uint64_t slowdownWrites, slowdownMicros;		//writes delayed by the soft limits and time spent delaying
+	uint64_t stopWrites, stopMicros;		//writes blocked by the hard limits and time spent blocked
+	uint64_t flushBytes, compactionBytes;		//bytes written into SSTables by flush and by compaction
+};
+
+//bytes held in memory, reported by KVStore::MemoryUsage
+struct memoryUsage{
+	uint64_t memTable;		//pairs of the memtable and its structure
+	uint64_t indexTables;		//index tables of the latest version, a reader pinning an older one may hold more
+	uint64_t indexCache;		//cached index partitions
+	uint64_t rowCache;		//values cached by key
+
+	uint64_t total() const{
+		return memTable + indexTables + indexCache + rowCache;
+	}
+};
 
 class KVStore : public KVStoreAPI{
 	// You can add your implementation here
 
-	typedef skiplist<uint64_t, std::string> memTable;
-	typedef quadnode<std::pair<uint64_t, std::string>> node;
 	friend class level;
+	friend void addSSTable(const memTableRep &m, level *le);
+	friend void addSSTable(const std::vector<record> &l, level *le, rateLimiter::priority p);
 
 	private:
-		std::shared_ptr<memTable> ptrToMemTable;				//resourse manager of memtable
+		std::shared_ptr<memTableRep> ptrToMemTable;				//resourse manager of memtable
 		fs::path storage;		//path of data storage
 		std::shared_ptr<std::list<level>> ptrToLevelTable; 		//resourse manager of leveltable
 		uint64_t SizeOfMemTable; 		//size of memtable
+		options opt;		//tunable parameters
+		std::shared_ptr<valueLog> vlog;		//resourse manager of value log
+		std::shared_ptr<threadPool> pool;		//workers for subcompactions
+		std::shared_ptr<asyncReader> reader;		//batched reader of SSTables and value log
+		std::shared_ptr<rateLimiter> limiter;		//throttle of flush and compaction I/O
+		std::shared_ptr<partitionCache> partitions;		//cache of index partitions
+		std::shared_ptr<rowCache> rows;		//cache of hot values by key, nullptr if disabled
+		std::shared_ptr<const version> current;		//latest published version, accessed atomically
+		std::shared_mutex memMutex;		//readers share the memtable, writers modify it exclusively
+		std::mutex writeMutex;		//serialize writers
+		uint64_t sequence;		//latest sequence number, guarded by writeMutex
+		std::atomic<uint64_t> nextFile;		//number of the next SSTable file
+		std::mutex levelMutex;		//guard the SSTable lists of levels between flush and background compaction
+		std::mutex compactionMutex;		//held by the compactor and ingestion, always taken before writeMutex
+		std::mutex workMutex;		//guard waiting on workCond and stallCond
+		std::condition_variable workCond;		//wake up background compaction
+		std::condition_variable stallCond;		//wake up writes blocked by the hard limits
+		bool stopping;		//background compaction should exit, guarded by workMutex
+		uint64_t delayDebt;		//nanoseconds of delay owed by writes, guarded by writeMutex
+		std::atomic<uint64_t> slowdownWrites, slowdownMicros, stopWrites, stopMicros;		//write stall statistic
+		std::atomic<uint64_t> flushBytes, compactionBytes;		//write amplification statistic
+		std::atomic<uint64_t> indexBytes;		//bytes of the index tables of the latest version held in memory, set by publish
+		std::thread compactor;		//runs compaction of level 0 in background
+		std::mutex recordMutex;		//guard recorder
+		std::unique_ptr<workloadRecorder> recorder;		//writer of the workload trace, nullptr if not recording
+		std::atomic<bool> recording;		//whether recorder is set, checked without recordMutex
+
+		std::unordered_map<uint64_t, uint64_t> expiries;		//expire time of memtable pairs having one
+
+		std::unordered_set<uint64_t> operands;		//keys of memtable pairs holding a merge operand
+
+		std::unordered_set<uint64_t> tombstones;		//keys of memtable pairs deleting older pairs
 
-		void putIntoMemTable(uint64_t key, const std::string &s){ //put pair into memtable
-			ptrToMemTable->put(key, s);
+		void putIntoMemTable(uint64_t key, const std::string &s, uint64_t expire = 0, bool operand = false){ //put pair into memtable, replacing the pair of key
+			SizeOfMemTable -= ptrToMemTable->put(key, s);
+			if (expire != 0) {
+				expiries[key] = expire;
+			}
+			else {
+				expiries.erase(key);
+			}
+			if (operand) {
+				operands.insert(key);
+			}
+			else {
+				operands.erase(key);
+			}
+			tombstones.erase(key);
+			if (rows != nullptr) {		//a reader may not cache the older value from now on
+				rows->erase(key);
+			}
 		}	
 
-		bool MemTableIsFull() const{		//whether the memtable is full
-			return SizeOfMemTable >= 2097152;
+		void putTombstone(uint64_t key){		//put a deleted pair into memtable, shadowing older pairs of key
+			putIntoMemTable(key, "");
+			tombstones.insert(key);
 		}
 
-		node *findInMemTable(uint64_t key){			//find pair in memtable
+		bool deletedInMemTable(uint64_t key) const{		//whether pair in memtable is deleted
+			return tombstones.find(key) != tombstones.end();
+		}
+
+		bool operandInMemTable(uint64_t key) const{		//whether pair in memtable is a merge operand
+			return operands.find(key) != operands.end();
+		}
+
+		uint64_t expireInMemTable(uint64_t key) const{		//expire time of pair in memtable, 0 if none
+			std::unordered_map<uint64_t, uint64_t>::const_iterator iter = expiries.find(key);
+			return iter == expiries.end() ? 0 : iter->second;
+		}
+
+		bool expiredInMemTable(uint64_t key) const{		//whether pair in memtable has expired by now
+			uint64_t expire = expireInMemTable(key);
+			return expire != 0 && expire <= (uint64_t)time(nullptr);
+		}
+
+		bool MemTableIsFull() const{		//whether the memtable is full, or over its share of the memory budget
+			return SizeOfMemTable + tombstones.size() * sizeof(index) >= 2097152 || overBudget();		//a deleted pair is flushed as an index alone
+		}
+
+		uint64_t memTableBytes() const{		//bytes held by memtable and the side tables of its pairs
+			return ptrToMemTable->memoryUsage() + expiries.bucket_count() * sizeof(void*) + expiries.size() * (sizeof(void*) + 2 * sizeof(uint64_t))
+				+ operands.bucket_count() * sizeof(void*) + operands.size() * (sizeof(void*) + sizeof(uint64_t))
+				+ tombstones.bucket_count() * sizeof(void*) + tombstones.size() * (sizeof(void*) + sizeof(uint64_t));
+		}
+
+		bool overBudget() const;		//whether memtable should be flushed to keep within the memory budget
+
+		void fitCache();		//shrink or regrow the caches to the room left in the memory budget
+
+		const std::string *findInMemTable(uint64_t key) const{			//find value in memtable, nullptr if not found
 			return ptrToMemTable->find(key);
 		}
 
 		void deleteInMemTable(uint64_t key){		//delete pair in memtable
 			SizeOfMemTable -= ptrToMemTable->remove(key);
+			expiries.erase(key);
+			operands.erase(key);
+			tombstones.erase(key);
+			if (rows != nullptr) {
+				rows->erase(key);
+			}
 		}
 
 		void transfer();		//transfer memtable to SSTable
 
+		void record(workloadOp::type op, uint64_t key, uint64_t size, uint64_t ttl = 0, uint64_t max = 0){		//add operation to the workload trace if recording
+			if (recording) {
+				std::lock_guard<std::mutex> lock(recordMutex);
+				if (recorder != nullptr) {
+					recorder->add(op, key, size, ttl, max);
+				}
+			}
+		}
+
+		std::string lookup(uint64_t key);		//get without being recorded or traced
+
+		std::shared_ptr<const version> pin() const{		//pin the latest version for a reader
+			return std::atomic_load(&current);
+		}
+
+		void publish();		//publish SSTables of every level as a new version
+
+		bool compactionNeeded() const{		//whether level 0 overflows in the latest version
+			return pin()->levels[0]->size() > ptrToLevelTable->front().Capacity();
+		}
+
+		std::shared_ptr<const IndexTable> denseTable(const TableList &tables) const;		//a SSTable over the tombstone ratio, nullptr if none
+
+		bool deletionNeeded() const;		//whether a level above the bottom holds a SSTable over the tombstone ratio
+
+		bool garbageNeeded() const;		//whether a value log file is to be collected
+
+		void compactInBackground();		//loop of the compactor thread
+
+		void delayWrite(uint64_t bytes, std::unique_lock<std::mutex> &writeLock);		//slow down or block a write while compaction falls behind
+
+		void collectGarbage();		//rewrite live values of sparse value log files, run by the compactor
+
+		std::vector<std::string> readValues(const std::vector<std::pair<index, fs::path>> &l);		//read values of indexs as one batch
+
+		std::vector<std::pair<index, fs::path>> history(uint64_t key, const version &v) const;		//all the indexs of key, newest first
+
+		bool foldOperands(uint64_t key, const std::string *pending, const version &v, std::string &result);		//apply merge operands of key to its value
+
 	public:
-		KVStore(const std::string &dir);
+		KVStore(const std::string &dir, const options &o = options());
 
 		~KVStore();
 
 		void put(uint64_t key, const std::string &s) override;
 
+		void put(uint64_t key, const std::string &s, uint64_t ttl);		//the pair expires ttl seconds later, 0 for never
+
 		std::string get(uint64_t key) override;
 
+		bool get(uint64_t key, pinnedSlice &value);		//pin the value instead of copying it, return false iff not found
+
 		bool del(uint64_t key) override;
 
+		void merge(uint64_t key, const std::string &operand);		//apply operand to the value through the registered merge operator
+
+		void ingestFiles(const std::vector<fs::path> &paths);		//take over SSTables built by SSTableWriter without rewriting
+
+		std::vector<std::string> multiGet(const std::vector<uint64_t> &keys);		//get values of many keys at once
+
+		std::vector<std::pair<uint64_t, std::string>> scan(uint64_t min, uint64_t max);		//all the pairs with key in [min, max]
+
+		statistics Stats() const;		//counters since the store is opened
+
+		memoryUsage MemoryUsage();		//bytes held in memory now
+
+		bool dumpTrace(const std::string &path) const;		//write traced flushes, compactions and slow gets as Chrome trace JSON
+
+		void startRecording(const std::string &path);		//record operations into a workload trace file at path, replayed by the replay tool
+
+		void stopRecording();		//finish the workload trace
+
 		void reset() override;
 };
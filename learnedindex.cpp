@@ -0,0 +1,54 @@
+#include "learnedindex.h"
+#include <limits>
+
+/**
+ * Fit segments in one pass with a shrinking cone.
+ * A segment starts at its first key and keeps the range of slopes that
+ * predicts every key added so far within error. A key narrowing the
+ * range to empty starts the next segment.
+ */
+learnedIndex::learnedIndex(const std::vector<uint64_t> &keys){
+	double low = 0, high = 0;
+
+	for (uint64_t position = 0; position < keys.size(); position++) {
+		if (!segments.empty()) {
+			segment &last = segments.back();
+			double dx = (double)(keys[position] - last.key), dy = (double)(position - last.position);
+			double newLow = std::max(low, (dy - error) / dx), newHigh = std::min(high, (dy + error) / dx);
+
+			if (newLow <= newHigh) {
+				low = newLow;
+				high = newHigh;
+				last.slope = (low + high) / 2;
+				continue;
+			}
+		}
+
+		segments.push_back(segment{keys[position], position, 0});
+		low = 0;
+		high = std::numeric_limits<double>::max();
+	}
+}
+
+/**
+ * Return through left and right the positions to search for key.
+ * Keys before the first segment get an empty window.
+ */
+void learnedIndex::window(uint64_t key, uint64_t &left, uint64_t &right) const{
+	std::vector<segment>::const_iterator next = std::upper_bound(segments.begin(), segments.end(), key, [](uint64_t key, const segment &s) { return key < s.key; });
+	if (next == segments.begin()) {
+		left = 1;
+		right = 0;
+		return;
+	}
+
+	const segment &s = *(next - 1);
+	double predicted = s.position + s.slope * (double)(key - s.key);
+	uint64_t position = predicted < 0 ? 0 : (uint64_t)predicted;
+
+	left = position > error + 1 ? position - error - 1 : 0;		//one more each side for rounding
+	right = position + error + 1;
+	if (next != segments.end()) {
+		right = std::min(right, next->position - 1);
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * Piecewise linear model mapping the sorted keys of a SSTable to their
+ * positions. Every segment predicts the position of its keys within
+ * error, so a lookup only searches a window of 2 * error + 1 entries
+ * around the prediction.
+ */
+class learnedIndex{
+
+	//keys from key on are predicted as position + slope * (k - key)
+	struct segment{
+		uint64_t key;
+		uint64_t position;
+		double slope;
+	};
+
+	protected:
+		std::vector<segment> segments;		//sorted by first key
+
+	public:
+		static const uint64_t error = 16;		//maximum distance of prediction from the real position
+
+		learnedIndex(){}
+
+		learnedIndex(const std::vector<uint64_t> &keys);		//fit segments to the sorted distinct keys
+
+		bool empty() const {
+			return segments.empty();
+		}
+
+		uint64_t memoryUsage() const {		//bytes of the segments
+			return segments.capacity() * sizeof(segment);
+		}
+
+		void window(uint64_t key, uint64_t &left, uint64_t &right) const;		//positions [left, right] to search for key
+};
@@ -1,59 +1,223 @@
 #include "level.h"
+#include "kvstore.h"
+#include "tracer.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <numeric>
+
+/**
+ * Map length bytes of file p from offset.
+ * The mapping starts at the page holding offset, data points at offset.
+ * If fail to open or map the file, throw run_time error.
+ */
+mappedFile::mappedFile(const fs::path &p, uint64_t offset, uint64_t length):data(nullptr),size(length),base(nullptr),mapSize(0){
+	if (length == 0) {
+		return;
+	}
+
+	int fd = open(p.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("fail to open " + p.string() + "!");
+	}
+
+	uint64_t aligned = offset - offset % sysconf(_SC_PAGESIZE);
+	mapSize = length + (offset - aligned);
+	base = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, aligned);
+	close(fd);
+	if (base == MAP_FAILED) {
+		base = nullptr;
+		throw std::runtime_error("fail to map " + p.string() + "!");
+	}
+
+	data = (const char*)base + (offset - aligned);
+}
+
+mappedFile::mappedFile(const fs::path &p):mappedFile(p, 0, fs::file_size(p)){}
+
+mappedFile::~mappedFile(){
+	if (base != nullptr) {
+		munmap(base, mapSize);
+	}
+}
+
+/**
+ * Write the header of an index file into out.
+ */
+void writeIndexHeader(std::ostream &out){
+	indexFileHeader header;
+	out.write((const char*)&header, sizeof(header));
+}
+
+/**
+ * Read the header of index file p from in.
+ * If it is missing or of another format, throw run_time error.
+ */
+void readIndexHeader(std::istream &in, const fs::path &p){
+	indexFileHeader expected, header;
+	if (!in.read((char*)&header, sizeof(header)) || header.magic != expected.magic) {
+		throw std::runtime_error(p.string() + " is not an index file of this version, the store may be written by an older one!");
+	}
+	if (header.version != expected.version || header.entrySize != expected.entrySize) {
+		throw std::runtime_error(p.string() + " has index format " + std::to_string(header.version) + ", only " + std::to_string(expected.version) + " is supported!");
+	}
+}
+
+/**
+ * Write the indexs l into a new index file at p.
+ * If fail to write the file, throw run_time error.
+ */
+void writeIndexFile(const fs::path &p, const std::vector<index> &l){
+	std::ofstream outFile(p.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+	writeIndexHeader(outFile);
+	outFile.write((const char*)l.data(), l.size() * sizeof(index));
+	outFile.close();
+	if (outFile.fail()) {
+		throw std::runtime_error("fail to write " + p.string() + "!");
+	}
+}
+
+/**
+ * Read all the indexs of the index file at p.
+ * If fail to open the file, or it is of another format, throw run_time
+ * error.
+ */
+std::vector<index> readIndexFile(const fs::path &p){
+	std::ifstream inFile(p.string(), std::ios::in | std::ios::binary);
+	if (!inFile) {
+		throw std::runtime_error("fail to open " + p.string() + "!");
+	}
+	readIndexHeader(inFile, p);
+
+	std::vector<index> result;
+	index tmp;
+	while (inFile.read((char*)&tmp, sizeof(tmp))) {
+		result.push_back(tmp);
+	}
+	return result;
+}
+
+/**
+ * Build the index table of SSTable p from its sorted indexs, searched
+ * and partitioned as the store is configured.
+ * f is the owner of the files if another index table of p has one.
+ */
+std::shared_ptr<const IndexTable> level::makeTable(const std::vector<index> &l, const fs::path &p, std::shared_ptr<const tableFile> f) const{
+	return std::make_shared<const IndexTable>(l, p, store->opt.search, store->opt.indexPartitionEntries, store->partitions, f);
+}
+
+/**
+ * Write records into a new SSTable(.dat file) of this level named after
+ * number, and its index into the index directory.
+ * Entries already living in the value log only get their index copied.
+ * The bytes are charged to the rate limiter with priority p first.
+ * Return the index table of the new SSTable.
+ */
+std::shared_ptr<const IndexTable> level::writeTable(const std::vector<record> &l, uint64_t number, rateLimiter::priority p) const{
+	fs::path path = levelPath / (std::to_string(number) + ".dat");		//the file path of new SSTable
+	fs::path indexPath = levelPath / "index" / (std::to_string(number) + ".dat");
+
+	std::vector<index> pairIndex;
+	uint64_t offset = 0, bytes = 0;
+
+	for (std::vector<record>::const_iterator tmp = l.begin(); tmp != l.end(); tmp++) {
+		bytes += sizeof(index) + (tmp->first.inLog ? 0 : tmp->second.size() + 1);
+	}
+	store->limiter->request(bytes, p);
+	(p == rateLimiter::high ? store->flushBytes : store->compactionBytes) += bytes;
+
+	//traverse record list
+	//write data to SSTable file and record on indextable
+	std::ofstream outFile1(path.string(), std::ios::out | std::ios::binary);
+	std::ofstream outFile2(indexPath.string(), std::ios::out | std::ios::binary);
+	writeIndexHeader(outFile2);
+	for (std::vector<record>::const_iterator tmp = l.begin(); tmp != l.end(); tmp++) {
+		index i = index(tmp->first.key, offset, 0, number, order);
+		i.sequence = tmp->first.sequence;
+		i.flag = tmp->first.flag;
+		i.expire = tmp->first.expire;
+		i.operand = tmp->first.operand;
+		if (tmp->first.inLog) {
+			i.inLog = true;
+			i.logFile = tmp->first.logFile;
+			i.offset = tmp->first.offset;
+			i.size = tmp->first.size;
+		}
+		else {
+			int SizeOfData = tmp->second.size() + 1;
+			outFile1.write(tmp->second.c_str(), SizeOfData);
+			i.size = SizeOfData;
+			offset += SizeOfData;
+		}
+		pairIndex.push_back(i);
+		outFile2.write((char*)&i, sizeof(i));
+	}
+	outFile1.close();
+	outFile2.close();
+
+	std::sort(pairIndex.begin(), pairIndex.end());
+	return makeTable(pairIndex, path);
+}
 
 /**
  * Add SSTable to level.
- * Create a new SSTable(.dat file), naming after the size of level.
- * Write pair into the SSTable and record index on indextable. 
+ * Create a new SSTable(.dat file), naming after a new file number.
+ * Write pair into the SSTable and record index on indextable.
+ * The caller publishes the new version.
  */
-void addSSTable(const quadlist<std::pair<uint64_t, std::string>> &l, level *le){
+void addSSTable(const std::vector<record> &l, level *le, rateLimiter::priority p){
 	if (!l.empty()) {
+		TRACE_SPAN(span, "addSSTable", le->order);
+		std::shared_ptr<const IndexTable> table = le->writeTable(l, le->store->nextFile++, p);
+		TRACE_ARG(span, tables, 1);
+		TRACE_ARG(span, bytes, table->bytes);
+
+		std::lock_guard<std::mutex> lock(le->store->levelMutex);		//compaction may be installing its result
+		std::shared_ptr<TableList> tables = std::make_shared<TableList>(*le->indextable);
+		tables->push_back(table);
+		le->indextable = tables;
 		le->size++;
-		fs::path name = le->levelPath / (std::to_string(le->size) + ".dat");		//the file path of new SSTable
-		fs::path indexPath = le->levelPath / "index" / (std::to_string(le->size) + ".dat");
-
-		quadnode<std::pair<uint64_t, std::string>> *tmp = l.first()->next;
-		std::vector<index> pairIndex;
-		uint64_t offset = 0;
-
-		//traverse pair list
-		//write data to SSTable file and record on indextable
-		std::ofstream outFile1(name.string(), std::ios::out | std::ios::binary);
-		std::ofstream outFile2(indexPath.string(), std::ios::out | std::ios::binary);
-		while (!isTailer(tmp)) {
-			int SizeOfData = tmp->data.second.size() + 1;
-			std::string buf = tmp->data.second + "\0";
-			const char *buffer = buf.c_str();
-			outFile1.write(buffer, SizeOfData);
-			index i = index((tmp->data).first, offset, SizeOfData, le->size, le->order);
-			pairIndex.push_back(i);
-			outFile2.write((char*)&i, sizeof(i));
-			offset += SizeOfData;
-			tmp = tmp->next;
-		}
-		outFile1.close();
-		outFile2.close();
+	}
+}
 
-		std::sort(pairIndex.begin(), pairIndex.end());
-		le->indextable->push_back(level::IndexTable(pairIndex, name));
+/**
+ * Add SSTable flushed from memtable to level.
+ * All the pairs get the same new sequence number.
+ * Values not smaller than the threshold are appended to the value log
+ * and only their position is kept in the SSTable.
+ */
+void addSSTable(const memTableRep &m, level *le){
+	std::vector<record> records;
+	uint64_t stamp = ++le->store->sequence;
 
-		if (pairIndex.front().key < le->minKey) {		//update minKey
-			le->minKey = pairIndex.front().key;
+	m.range(0, UINT64_MAX, [le, stamp, &records](uint64_t key, const std::string &value) {
+		index i = index(key, 0, 0, 0, 0);
+		i.sequence = stamp;
+		i.expire = le->store->expireInMemTable(i.key);
+		i.operand = le->store->operandInMemTable(i.key);
+		i.flag = le->store->deletedInMemTable(i.key);
+		if (value.size() >= le->store->opt.valueThreshold) {
+			i.inLog = true;
+			i.size = value.size();
+			le->store->vlog->append(i.key, value, i.logFile, i.offset);
+			records.push_back(record(i, ""));
 		}
-
-		if (pairIndex.back().key > le->maxKey) {		//update maxKey
-			le->maxKey = pairIndex.back().key;
+		else {
+			records.push_back(record(i, value));
 		}
-	}
+	});
+
+	le->store->vlog->sync();		//make the values readable before the SSTable refers to them
+	addSSTable(records, le, rateLimiter::high);
 }
 
 /**
- * Binary Search in SSTable' index.
+ * Binary Search in [left, right] of SSTable' index.
  * Return the pair's position in vector of index.
  * If fail to find the pair, return -1.
  */
-int level::binarySearch(const std::vector<index> &l, uint64_t key) const{
-    int left = 0, right = l.size() - 1;
-
+static int searchRange(const std::vector<index> &l, uint64_t key, int left, int right){
+    PERF_COUNT(binarySearches, 1);
     while(left <= right){
         int mid = (left + right) / 2;
         if(key ==  l[mid].key){
@@ -66,7 +230,215 @@ int level::binarySearch(const std::vector<index> &l, uint64_t key) const{
     }
 
     return -1;
-}   
+}
+
+/**
+ * Binary Search in SSTable' index.
+ * Return the pair's position in vector of index.
+ * If fail to find the pair, return -1.
+ */
+int level::binarySearch(const std::vector<index> &l, uint64_t key) const{
+	return searchRange(l, key, 0, l.size() - 1);
+}
+
+static std::atomic<uint64_t> nextTableId(0);		//ids of index tables, never reused
+
+/**
+ * Build the index table of a SSTable from its sorted indexs.
+ * If n is not 0, the indexs are dropped from memory except the first key
+ * of every n indexs, otherwise the learned model or the static B+-tree
+ * the table is searched by is built.
+ */
+IndexTable::IndexTable(const std::vector<index> &i, const fs::path &p, indexSearch s, uint64_t n, std::shared_ptr<partitionCache> c, std::shared_ptr<const tableFile> f):std::pair<std::vector<index>, fs::path>(i, p),file(f != nullptr ? f : std::make_shared<const tableFile>(p)),bytes(0),count(i.size()),deleted(0),smallest(i.empty() ? 0 : i.front().key),largest(i.empty() ? 0 : i.back().key),id(nextTableId++),partitionSize(n),cache(c){
+	for (std::vector<index>::const_iterator iter = first.begin(); iter != first.end(); iter++) {
+		bytes += sizeof(index) + (iter->inLog ? 0 : iter->size);
+		if (iter->flag) {
+			deleted++;
+		}
+	}
+
+	if (partitionSize != 0) {
+		for (uint64_t position = 0; position < count; position += partitionSize) {
+			partitions.push_back(first[position].key);
+		}
+		std::vector<index>().swap(first);
+		return;
+	}
+
+	if (s == indexSearch::binary) {
+		return;
+	}
+
+	std::vector<uint64_t> keys;
+	for (std::vector<index>::const_iterator iter = first.begin(); iter != first.end(); iter++) {
+		keys.push_back(iter->key);
+	}
+
+	if (s == indexSearch::learned) {
+		model = learnedIndex(keys);
+	}
+	else {
+		tree = eytzingerIndex(keys);
+	}
+}
+
+/**
+ * Remove the files of a SSTable compacted away.
+ */
+tableFile::~tableFile(){
+	if (obsolete) {
+		std::error_code ec;
+		fs::remove(path, ec);
+		fs::remove(path.parent_path() / "index" / path.filename(), ec);
+	}
+}
+
+/**
+ * Partitions of the table are useless once it is gone.
+ */
+IndexTable::~IndexTable(){
+	if (cache != nullptr) {
+		for (uint64_t p = 0; p < partitions.size(); p++) {
+			cache->erase(std::make_pair(id, p));
+		}
+	}
+}
+
+/**
+ * Return the p-th partition, reading it from the index file on a miss.
+ * If fail to open the index file, throw run_time error.
+ */
+std::shared_ptr<const std::vector<index>> IndexTable::partition(uint64_t p) const{
+	std::pair<uint64_t, uint64_t> k(id, p);
+	std::shared_ptr<const std::vector<index>> result = cache != nullptr ? cache->find(k) : nullptr;
+	if (result != nullptr) {
+		PERF_COUNT(cacheHits, 1);
+		return result;
+	}
+	PERF_COUNT(cacheMisses, 1);
+
+	std::ifstream inFile(indexPath().string(), std::ios::in | std::ios::binary);
+	if (!inFile) {
+		throw std::runtime_error("fail to open index of SSTable!");
+	}
+
+	std::shared_ptr<std::vector<index>> indexes = std::make_shared<std::vector<index>>(std::min(partitionSize, count - p * partitionSize));
+	PERF_COUNT(fileOpens, 1);
+	PERF_COUNT(bytesRead, indexes->size() * sizeof(index));
+	inFile.seekg(sizeof(indexFileHeader) + p * partitionSize * sizeof(index), std::ios::beg);
+	inFile.read((char*)indexes->data(), indexes->size() * sizeof(index));
+
+	if (cache != nullptr) {
+		cache->insert(k, indexes, indexes->size() * sizeof(index));
+	}
+	return indexes;
+}
+
+/**
+ * Return all the indexs, a partitioned index is read from the file as a
+ * whole without going through the cache.
+ */
+std::shared_ptr<const std::vector<index>> IndexTable::load() const{
+	if (partitionSize == 0) {
+		return std::shared_ptr<const std::vector<index>>(std::shared_ptr<const IndexTable>(), &first);		//not owning, valid as long as the table
+	}
+
+	std::ifstream inFile(indexPath().string(), std::ios::in | std::ios::binary);
+	if (!inFile) {
+		throw std::runtime_error("fail to open index of SSTable!");
+	}
+
+	std::shared_ptr<std::vector<index>> indexes = std::make_shared<std::vector<index>>(count);
+	inFile.seekg(sizeof(indexFileHeader), std::ios::beg);
+	inFile.read((char*)indexes->data(), count * sizeof(index));
+	return indexes;
+}
+
+/**
+ * Search key in the index.
+ * A partitioned index searches the only partition that may hold key.
+ * A static B+-tree gives the position of the first key not less than key.
+ * With a learned model only the predicted window is searched, it falls
+ * back to the whole index should key lie outside the window.
+ */
+bool IndexTable::search(uint64_t key, index &result) const{
+	PERF_COUNT(filterChecks, 1);
+	if (count == 0 || key < smallest || key > largest) {
+		PERF_COUNT(filterSkips, 1);
+		return false;
+	}
+	PERF_COUNT(indexSearches, 1);
+
+	const std::vector<index> *indexes = &first;
+	std::shared_ptr<const std::vector<index>> holder;
+	int position;
+
+	if (partitionSize != 0) {
+		uint64_t p = std::upper_bound(partitions.begin(), partitions.end(), key) - partitions.begin() - 1;
+		holder = partition(p);
+		indexes = holder.get();
+		position = searchRange(*indexes, key, 0, indexes->size() - 1);
+	}
+	else if (!tree.empty()) {
+		int64_t lower = tree.lowerBound(key);
+		position = (lower != -1 && first[lower].key == key) ? lower : -1;
+	}
+	else if (model.empty()) {
+		position = searchRange(first, key, 0, first.size() - 1);
+	}
+	else {
+		uint64_t left, right;
+		model.window(key, left, right);
+		right = std::min<uint64_t>(right, first.size() - 1);
+		if (left > right) {
+			position = -1;
+		}
+		else if ((left > 0 && key < first[left].key) || (right + 1 < first.size() && key > first[right].key)) {
+			position = searchRange(first, key, 0, first.size() - 1);
+		}
+		else {
+			position = searchRange(first, key, left, right);
+		}
+	}
+
+	if (position == -1) {
+		return false;
+	}
+	result = (*indexes)[position];
+	return true;
+}
+
+/**
+ * Return the indexs of keys in [min, max] in order.
+ */
+std::vector<index> IndexTable::range(uint64_t min, uint64_t max) const{
+	std::vector<index> result;
+	if (count == 0 || max < smallest || min > largest) {
+		return result;
+	}
+
+	uint64_t p = 0, last = 0;
+	if (partitionSize != 0) {
+		p = std::upper_bound(partitions.begin(), partitions.end(), min) - partitions.begin();
+		p = p == 0 ? 0 : p - 1;
+		last = partitions.size() - 1;
+	}
+
+	for (; p <= last; p++) {
+		std::shared_ptr<const std::vector<index>> holder = partitionSize != 0 ? partition(p) : nullptr;
+		const std::vector<index> &indexes = partitionSize != 0 ? *holder : first;
+
+		std::vector<index>::const_iterator i = std::lower_bound(indexes.begin(), indexes.end(), min, [](const index &i, uint64_t key) { return i.key < key; });
+		for (; i != indexes.end() && i->key <= max; i++) {
+			result.push_back(*i);
+		}
+		if (i != indexes.end()) {
+			break;
+		}
+	}
+
+	return result;
+}
 
 /**
  * Read value from SSTable.
@@ -78,269 +450,717 @@ std::string level::ReadFromSSTable(uint64_t offset, fs::path name, uint64_t size
         throw std::runtime_error("fail to open SSTable!");
     }
 
-    char buffer[100000];
+    PERF_COUNT(fileOpens, 1);
+    PERF_COUNT(bytesRead, size);
+    std::string buffer(size, '\0');
     inFile.seekg(offset, std::ios::beg);        //set file pointer to the right position
-    inFile.read(buffer, size);
+    inFile.read(&buffer[0], size);
 
 	inFile.close();
-    return std::string(buffer);
+    return std::string(buffer.c_str());
 }
 
 /**
- * Get value from all the SSTable in this level.
- * If fail to find the pair, return empty string.
+ * Read the value an index refers to.
+ * If the value is separated, read it from the value log instead of SSTable,
+ * found is set false if the log file has been collected meanwhile.
  */
-std::string level::get(uint64_t key) const{
-    //traverse all the SSTable in this level
-	if(size != 0) {
-		clock_t stamp = 0;
-		int position = -1;
-		std::list<IndexTable>::iterator it = indextable->end();
+std::string level::readValue(const index &i, const fs::path &name, bool *found) const{
+	PERF_TIMER(timer, valueNanos);
+	if (i.inLog) {
+		return store->vlog->read(i.logFile, i.offset, i.size, found);
+	}
 
-		//find the latest updated item in this level
-		for (std::list<IndexTable>::iterator iter = indextable->begin(); iter != indextable->end(); iter++) {
-			int tmp = binarySearch(iter->first, key);
-			if (tmp != -1 ) {
-				if (iter->first[tmp].timeStamp > stamp) {
-					position = tmp;
-					it = iter;
-					stamp = iter->first[tmp].timeStamp;
-				}
+	if (found != nullptr) {
+		*found = true;
+	}
+	return ReadFromSSTable(i.offset, name, i.size);
+}
+
+/**
+ * Pin the value an index of table refers to without copying it.
+ * A SSTable is mapped once and shared by all its pinned values, a
+ * separated value maps just its own region of the log file.
+ * found is set false if the log file has been collected meanwhile.
+ */
+pinnedSlice level::pinValue(const index &i, const IndexTable &table, bool *found) const{
+	PERF_TIMER(timer, valueNanos);
+	PERF_COUNT(bytesRead, i.size);
+	if (found != nullptr) {
+		*found = true;
+	}
+
+	if (i.inLog) {
+		try {
+			PERF_COUNT(fileOpens, 1);
+			std::shared_ptr<const mappedFile> region = std::make_shared<const mappedFile>(store->vlog->filePath(i.logFile), i.offset, i.size);
+			return pinnedSlice(std::string_view(region->data, region->size), region);
+		}catch (const std::exception &e) {
+			if (found != nullptr) {
+				*found = false;
 			}
+			return pinnedSlice();
 		}
+	}
+
+	std::shared_ptr<const mappedFile> file = table.map();
+	if (i.offset + i.size > file->size) {
+		throw std::runtime_error("fail to open SSTable!");
+	}
 
-		if (it != indextable->end() && !it->first[position].flag) {
-			return ReadFromSSTable(it->first[position].offset, it->second, it->first[position].size);
+	//values are stored with a terminating '\0'
+	std::string_view value(file->data + i.offset, i.size);
+	return pinnedSlice(value.substr(0, value.find('\0')), file);
+}
+
+/**
+ * Find the latest updated index of key among the SSTables of this level
+ * in tables, which is either a pinned version or the writer's view.
+ * The index is copied into result, the path and the index table of the
+ * SSTable are returned through name and table if given.
+ * If fail to find the pair, return false.
+ */
+bool level::find(const TableList &tables, uint64_t key, index &result, fs::path *name, std::shared_ptr<const IndexTable> *table) const{
+	PERF_TIMER(timer, indexNanos);
+	PERF_COUNT(levelsSearched, 1);
+	bool found = false;
+	index tmp;
+
+	//traverse all the SSTable in this level
+	for (TableList::const_iterator iter = tables.begin(); iter != tables.end(); iter++) {
+		if ((*iter)->search(key, tmp) && (!found || tmp.sequence > result.sequence)) {
+			found = true;
+			result = tmp;
+			if (name != nullptr) {
+				*name = (*iter)->second;
+			}
+			if (table != nullptr) {
+				*table = *iter;
+			}
 		}
 	}
 
-    return "";
+	return found;
 }
 
 /**
- * Lazy delete the pair in this level.
- * If the pair is in this level, change its flag and update
- * its timeStamp, return true, else return false.
+ * Append all the indexs of key among the SSTables of this level in
+ * tables to result, each with the path of its SSTable.
  */
-bool level::del(uint64_t key){
-	if (size != 0) {
-		for (std::list<IndexTable>::iterator iter = indextable->begin(); iter != indextable->end(); iter++) {
-			int position = binarySearch(iter->first, key);
-			if (position != -1 && !iter->first[position].flag) {
-				iter->first[position].flag = true;
-				iter->first[position].timeStamp = clock();
+void level::findAll(const TableList &tables, uint64_t key, std::vector<std::pair<index, fs::path>> &result) const{
+	index tmp;
+	for (TableList::const_iterator iter = tables.begin(); iter != tables.end(); iter++) {
+		if ((*iter)->search(key, tmp)) {
+			result.push_back(std::make_pair(tmp, (*iter)->second));
+		}
+	}
+}
 
-				fs::path indexPath = levelPath / "index" / (std::to_string(iter->first[position].order) + ".dat");
-				fs::remove(indexPath);
-				std::ofstream outFile(indexPath.string(), std::ios::out | std::ios::binary);
+/**
+ * Find the latest updated indexs of all the keys in [min, max] among the
+ * SSTables of this level in tables.
+ * Keys already in result are found in upper levels and kept untouched.
+ */
+void level::range(const TableList &tables, uint64_t min, uint64_t max, std::map<uint64_t, std::pair<index, fs::path>> &result) const{
+	std::map<uint64_t, std::pair<index, fs::path>> found;
 
-				for (std::vector<index>::iterator i = iter->first.begin(); i != iter->first.begin(); i++) {
-					outFile.write((char*)&(*i), sizeof(*i));
-				}
-				return true;
+	for (TableList::const_iterator iter = tables.begin(); iter != tables.end(); iter++) {
+		std::vector<index> indexes = (*iter)->range(min, max);
+		for (std::vector<index>::iterator i = indexes.begin(); i != indexes.end(); i++) {
+			std::map<uint64_t, std::pair<index, fs::path>>::iterator position = found.find(i->key);
+			if (position == found.end()) {
+				found.insert(std::make_pair(i->key, std::make_pair(*i, (*iter)->second)));
+			}
+			else if (i->sequence > position->second.first.sequence) {
+				position->second = std::make_pair(*i, (*iter)->second);
 			}
 		}
 	}
 
+	result.insert(found.begin(), found.end());
+}
+
+/**
+ * Whether any SSTable of this level holds keys in [min, max].
+ */
+bool level::overlaps(uint64_t min, uint64_t max) const{
+	for (TableList::const_iterator iter = indextable->begin(); iter != indextable->end(); iter++) {
+		if ((*iter)->smallest <= max && (*iter)->largest >= min) {
+			return true;
+		}
+	}
+
 	return false;
 }
 
 /**
- * Find all the SSTable in next level that is covered 
- * by the range of keys in this level.
+ * Move the SSTable at p, built by SSTableWriter, into this level under a
+ * new file number without rewriting its values. Its sorted indexs l get
+ * the number, the level and sequence number stamp, and are written as
+ * the index file. The data file is copied only if it can not be renamed.
+ * The caller publishes the new version.
+ */
+void level::ingestTable(const fs::path &p, std::vector<index> l, uint64_t stamp){
+	uint64_t number = store->nextFile++;
+	fs::path path = levelPath / (std::to_string(number) + ".dat");
+	fs::path indexPath = levelPath / "index" / (std::to_string(number) + ".dat");
+
+	for (std::vector<index>::iterator i = l.begin(); i != l.end(); i++) {
+		i->order = number;
+		i->level = order;
+		i->sequence = stamp;
+		i->flag = false;
+		i->inLog = false;
+		i->operand = false;
+		i->expire = 0;
+	}
+
+	std::error_code ec;
+	fs::rename(p, path, ec);
+	if (ec) {		//on another file system
+		fs::copy_file(p, path);
+		fs::remove(p);
+	}
+
+	//the index file comes last, restoreIndex never sees a SSTable without data
+	writeIndexFile(indexPath, l);
+
+	std::shared_ptr<const IndexTable> table = makeTable(l, path);
+	std::lock_guard<std::mutex> lock(store->levelMutex);
+	std::shared_ptr<TableList> tables = std::make_shared<TableList>(*indextable);
+	tables->push_back(table);
+	indextable = tables;
+	size++;
+}
+
+/**
+ * Take over SSTable t of the level above without rewriting its values.
+ * The SSTable is hard linked into this level under the same file number,
+ * only its index file is written again. The old link goes away with the
+ * old index table, once no reader holds it.
+ */
+std::shared_ptr<const IndexTable> level::moveTable(const IndexTable &t) const{
+	TRACE_SPAN(span, "moveTable", order);
+	TRACE_ARG(span, tables, 1);
+	TRACE_ARG(span, bytes, t.count * sizeof(index));
+	fs::path path = levelPath / t.second.filename();
+	fs::path indexPath = levelPath / "index" / t.second.filename();
+
+	std::vector<index> indexes = *t.load();
+	for (std::vector<index>::iterator i = indexes.begin(); i != indexes.end(); i++) {
+		i->level = order;
+	}
+
+	fs::create_hard_link(t.second, path);
+	writeIndexFile(indexPath, indexes);
+
+	return makeTable(indexes, path);
+}
+
+/**
+ * Pick the SSTables of tables to compact next.
+ * If seed is not given, level 0 starts from its oldest SSTable, other
+ * levels from the one with the highest score under the configured
+ * priority. Ties go to the first SSTable after the compaction pointer,
+ * round robin.
+ * SSTables of the level overlapping the picked ones are added until none
+ * is left, so no older pair of a key stays above a newer one.
  */
-std::list<level::IndexTable*> level::findCoveredTable() const {
-	std::list<IndexTable*> result;
+TableList level::pickInputs(const TableList &tables, std::shared_ptr<const IndexTable> seed) const{
+	std::vector<std::shared_ptr<const IndexTable>> candidates(tables.begin(), tables.end());
 
-	for (std::list<IndexTable>::iterator iter = nextLevel->indextable->begin(); iter != nextLevel->indextable->end(); iter++) {
-		if (iter->first.front().key <= maxKey && iter->first.back().key >= minKey) {
-			result.push_back(&(*iter));
+	if (seed == nullptr && order == 0) {
+		seed = candidates.front();
+	}
+	else if (seed == nullptr) {
+		//round robin order, starting after the compaction pointer
+		uint64_t pointer = compactPointer;
+		std::stable_sort(candidates.begin(), candidates.end(), [pointer](const std::shared_ptr<const IndexTable> &a, const std::shared_ptr<const IndexTable> &b) {
+			bool wrapA = a->smallest <= pointer, wrapB = b->smallest <= pointer;
+			return wrapA != wrapB ? wrapB : a->smallest < b->smallest;
+		});
+		seed = candidates.front();
+
+		double best = -1;
+		for (std::vector<std::shared_ptr<const IndexTable>>::iterator iter = candidates.begin(); store->opt.pick != compactionPriority::roundRobin && iter != candidates.end(); iter++) {
+			double score;
+			if (store->opt.pick == compactionPriority::tombstones) {
+				score = (double)(*iter)->deleted / std::max<uint64_t>(1, (*iter)->count);
+			}
+			else {
+				uint64_t overlap = 0;
+				for (TableList::const_iterator next = nextLevel->indextable->begin(); next != nextLevel->indextable->end(); next++) {
+					if ((*next)->smallest <= (*iter)->largest && (*next)->largest >= (*iter)->smallest) {
+						overlap += (*next)->bytes;
+					}
+				}
+				score = (double)(*iter)->bytes / (1 + overlap);
+			}
+
+			if (score > best) {
+				best = score;
+				seed = *iter;
+			}
+		}
+	}
+
+	TableList result(1, seed);
+	uint64_t minKey = seed->smallest, maxKey = seed->largest;
+	for (bool grown = true; grown;) {
+		grown = false;
+		for (TableList::const_iterator iter = tables.begin(); iter != tables.end(); iter++) {
+			if ((*iter)->smallest <= maxKey && (*iter)->largest >= minKey && std::find(result.begin(), result.end(), *iter) == result.end()) {
+				result.push_back(*iter);
+				minKey = std::min(minKey, (*iter)->smallest);
+				maxKey = std::max(maxKey, (*iter)->largest);
+				grown = true;
+			}
 		}
 	}
 
 	return result;
 }
 
+/**
+ * Find all the SSTable in next level that is covered
+ * by the range of keys in inputs.
+ */
+TableList level::findCoveredTable(const TableList &inputs) const {
+	TableList result;
+	uint64_t minKey = UINT64_MAX, maxKey = 0;
+
+	for (TableList::const_iterator iter = inputs.begin(); iter != inputs.end(); iter++) {
+		minKey = std::min(minKey, (*iter)->smallest);
+		maxKey = std::max(maxKey, (*iter)->largest);
+	}
+
+	for (TableList::const_iterator iter = nextLevel->indextable->begin(); iter != nextLevel->indextable->end(); iter++) {
+		if ((*iter)->smallest <= maxKey && (*iter)->largest >= minKey) {
+			result.push_back(*iter);
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Whether any SSTable in kept, the SSTables of next level not joining
+ * the compaction, or in the levels below next level covers key.
+ * If not, a deleted pair merged into next level can be dropped.
+ */
+bool level::coveredBelow(uint64_t key, const TableList &kept) const{
+	for (TableList::const_iterator iter = kept.begin(); iter != kept.end(); iter++) {
+		if ((*iter)->smallest <= key && (*iter)->largest >= key) {
+			return true;
+		}
+	}
+
+	for (level *l = nextLevel->nextLevel; l != nullptr; l = l->nextLevel) {
+		for (TableList::const_iterator iter = l->indextable->begin(); iter != l->indextable->end(); iter++) {
+			if ((*iter)->smallest <= key && (*iter)->largest >= key) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 /**
  * Merge all the same keys in the sorted tmpIndexTable.
  * Remain the nearest index and delete all the others.
+ * A deleted or expired nearest index is kept as a deleted one without
+ * value while an older pair may live below, otherwise it is dropped as
+ * well.
+ * A nearest merge operand is folded with the older operands down to the
+ * first value or deleted pair, the result goes into folded and is kept
+ * as a value. It stays an operand only if no value is met and an older
+ * pair may live below. Operands whose values are collected from the value
+ * log are shadowed by a newer pair, and merged as a deleted pair.
+ * Dropped entries pointing into the value log are reported as garbage.
  */
-void level::merge(std::vector<index> &tmpIndexTable) {
-	for (std::vector<index>::iterator iter = tmpIndexTable.begin(); iter != tmpIndexTable.end();iter++) {
+void level::merge(std::vector<index> &tmpIndexTable, const TableList &kept, std::map<uint64_t, std::string> &folded) {
+	std::vector<index> result;
+	std::vector<std::pair<index, fs::path>> reads;		//entries to fold, newest first for each key
+	std::vector<std::pair<size_t, size_t>> chains;		//position in result and number of reads of each folded key
+	std::vector<bool> based;		//whether each folded key met a value or deleted pair
+
+	for (std::vector<index>::iterator iter = tmpIndexTable.begin(); iter != tmpIndexTable.end();) {
 		std::vector<index>::iterator next = iter + 1;
-		clock_t timeStamp = iter->timeStamp;
 		std::vector<index>::iterator nearestOne = iter;
-		
+
 		//find the nearest index among the same keys
 		while (next != tmpIndexTable.end() && next->key == iter->key) {
-			if (next->timeStamp > timeStamp) {
+			if (next->sequence > nearestOne->sequence) {
 				nearestOne = next;
-				timeStamp = next->timeStamp;
 			}
 			next++;
 		}
 
+		bool dead = nearestOne->dead();
+
+		if (!dead && nearestOne->operand) {
+			std::sort(iter, next, [](const index &a, const index &b) { return a.sequence > b.sequence; });
+			nearestOne = iter;
+
+			size_t first = reads.size();
+			bool collected = false;
+			std::vector<index>::iterator i = iter;
+			for (; i != next && !i->dead(); i++) {
+				if (i->inLog && !fs::exists(store->vlog->filePath(i->logFile))) {
+					collected = true;
+					break;
+				}
+				reads.push_back(std::make_pair(*i, tablePath(*i)));
+				if (!i->operand) {
+					break;
+				}
+			}
+
+			if (collected) {		//garbage collection only drops values shadowed by a newer pair
+				reads.resize(first);
+				dead = true;
+			}
+			else {
+				chains.push_back(std::make_pair(result.size(), reads.size() - first));
+				based.push_back(i != next);
+				result.push_back(*iter);
+
+				//the folded value is written into the SSTable, even a large one
+				for (; iter != next; iter++) {
+					if (iter->inLog) {
+						store->vlog->discard(iter->logFile, iter->size);
+					}
+				}
+				continue;
+			}
+		}
+
+		bool keep = !dead || coveredBelow(nearestOne->key, kept);
+
 		//delete all the other indexs
-		if (nearestOne->flag) {			//if the nearest index is deleted
-			iter = --tmpIndexTable.erase(iter, next);
-		} 
-		else {
-			if (next != iter + 1) {
-				int offset = next - nearestOne;
-				nearestOne = tmpIndexTable.erase(iter, nearestOne);
-				next = nearestOne + offset;
-				iter = --tmpIndexTable.erase(++nearestOne, next);
+		for (; iter != next; iter++) {
+			if (iter == nearestOne && keep) {
+				result.push_back(*iter);
+				if (dead) {			//kept as a deleted pair, which needs no value
+					result.back().flag = true;
+					if (iter->inLog) {
+						store->vlog->discard(iter->logFile, iter->size);
+						result.back().inLog = false;
+					}
+				}
+			}
+			else if (iter->inLog) {
+				store->vlog->discard(iter->logFile, iter->size);
 			}
 		}
 	}
-}
 
-/**
- * Find whether the iter is in the list
- */
-bool level::inTable(std::list<IndexTable>::iterator &iter, std::list<IndexTable*> &l) const{
-	for (std::list<IndexTable*>::iterator i = l.begin(); i != l.end(); i++) {
-		if (&(*iter) == *i) {
-			return true;
+	if (!chains.empty()) {
+		if (store->opt.merger == nullptr) {
+			throw std::runtime_error("no merge operator is registered!");
+		}
+
+		uint64_t bytes = 0;
+		for (std::vector<std::pair<index, fs::path>>::iterator r = reads.begin(); r != reads.end(); r++) {
+			bytes += r->first.size;
+		}
+		store->limiter->request(bytes, rateLimiter::low);
+		std::vector<std::string> values = store->readValues(reads);
+
+		size_t r = 0;
+		for (size_t c = 0; c < chains.size(); c++) {
+			std::string value = values[r];
+			const index *last = &reads[r].first;
+			for (size_t n = 1; n < chains[c].second; n++) {
+				value = store->opt.merger->merge(&values[r + n], value);
+				last = &reads[r + n].first;
+			}
+			r += chains[c].second;
+
+			index &i = result[chains[c].first];
+			i.inLog = false;
+			i.expire = 0;
+			if (!last->operand) {		//ended at a value
+				i.operand = false;
+				i.expire = last->expire;
+			}
+			else if (based[c] || !coveredBelow(i.key, kept)) {		//deleted below, or no value anywhere
+				value = store->opt.merger->merge(nullptr, value);
+				i.operand = false;
+			}
+			i.size = value.size() + 1;
+			folded[i.key] = value;
 		}
 	}
 
-	return false;
+	tmpIndexTable.swap(result);
 }
 
 /**
- * Rename all the SSTables in this level.
- * Naming them by order.
+ * Compact the merged indexs in [begin, end) into new SSTables of next level.
+ * Values of keys in folded are written as given instead of read.
+ * Create a SSTable for every 2MB data, each with a new file number so
+ * that subcompactions running in parallel never collide.
+ * Both reading inputs and writing outputs are charged to the rate limiter
+ * with low priority, so flush is not held up behind compaction.
  */
-void level::renaming() {
-	int Size = 0;
-	fs::remove_all(levelPath / "index");
-	fs::create_directory(levelPath / "index");
+TableList level::subcompaction(std::vector<index>::const_iterator begin, std::vector<index>::const_iterator end, const std::map<uint64_t, std::string> &folded) const{
+	TRACE_SPAN(span, "subcompaction", nextLevel->order);
+	TableList result;
 
-	for (std::list<IndexTable>::iterator iter = indextable->begin(); iter != indextable->end(); iter++) {
-		Size++;
-		fs::path name = levelPath / (std::to_string(Size) + ".dat");
-		fs::rename(iter->second, name);
-		fs::path indexPath = levelPath / "index" / (std::to_string(Size) + ".dat");
-		std::ofstream outFile(indexPath.string(), std::ios::out | std::ios::binary);
+	//separated values and deleted pairs are not read, only their index is carried over
+	//folded values are taken from folded
+	//values of a SSTable are read from inputs as one batch
+	unsigned Size = 0;
+	std::vector<index> chunk;
+	for (std::vector<index>::const_iterator i = begin; i != end; i++) {
+		chunk.push_back(*i);
+		Size += (i->inLog || i->flag) ? sizeof(index) : i->size;
 
-		for (std::vector<index>::iterator j = iter->first.begin(); j != iter->first.end(); j++) {
-			outFile.write((char *)&(*j), sizeof(*j));
-		}
+		if (Size >= 2097152 || i + 1 == end) {
+			std::vector<std::pair<index, fs::path>> reads;
+			uint64_t bytes = 0;
+			for (std::vector<index>::iterator j = chunk.begin(); j != chunk.end(); j++) {
+				if (!j->inLog && !j->flag && folded.find(j->key) == folded.end()) {
+					reads.push_back(std::make_pair(*j, tablePath(*j)));
+					bytes += j->size;
+				}
+			}
+			store->limiter->request(bytes, rateLimiter::low);
+			std::vector<std::string> values = store->readValues(reads);
+
+			std::vector<record> tmp;
+			std::vector<std::string>::iterator value = values.begin();
+			for (std::vector<index>::iterator j = chunk.begin(); j != chunk.end(); j++) {
+				std::map<uint64_t, std::string>::const_iterator f = folded.find(j->key);
+				if (f != folded.end()) {
+					tmp.push_back(record(*j, f->second));
+				}
+				else {
+					tmp.push_back(record(*j, (j->inLog || j->flag) ? "" : *(value++)));
+				}
+			}
 
-		for (std::vector<index>::iterator i = iter->first.begin(); i != iter->first.end(); i++) {
-			i->level = order;
-			i->order = Size;
+			result.push_back(nextLevel->writeTable(tmp, store->nextFile++, rateLimiter::low));
+			chunk.clear();
+			Size = 0;
 		}
 	}
+
+	TRACE_ARG(span, tables, result.size());
+	TRACE_ARG(span, bytes, std::accumulate(result.begin(), result.end(), (uint64_t)0, [](uint64_t sum, const std::shared_ptr<const IndexTable> &t) { return sum + t->bytes; }));
+	return result;
 }
 
 /**
  * Do compaction between two level when overflow happened.
- * Find all the covered SSTables in next level and merge them with
- * all the SSTables in this level, then write them to the next level.
+ * Pick some SSTables of this level, find all the covered SSTables in
+ * next level and merge them together, then write them to the next level.
+ * The compaction pointer moves past the picked key range.
+ * The merged key range is split at the boundaries of covered SSTables
+ * into subcompactions, which run in parallel on the thread pool.
+ * The result is published as one new version, input SSTables are removed
+ * once no reader holds an older version.
+ * Level 0 is compacted in background while flush keeps adding SSTables,
+ * so only SSTables present at the start are picked.
+ * An input SSTable overlapping neither the other inputs, the range the
+ * merged outputs span, nor next level is moved into next level without
+ * rewriting.
+ * A tiered compaction merges all the SSTables of this level into one
+ * sorted run of next level, leaving the runs already there untouched.
+ * Given a seed SSTable, heavy with deleted pairs, the compaction starts
+ * from it in either style, and never moves it without rewriting.
  */
-void level::compaction() {
-	if (nextLevel == nullptr) {					//if this is the bottom level 
+void level::compaction(std::shared_ptr<const IndexTable> seed) {
+	if (nextLevel == nullptr) {					//if this is the bottom level
 		throw std::runtime_error("There is not enough memory to store these data!");
 	}
 
-	std::list<IndexTable*> CoveredTable = findCoveredTable();
-	std::list<IndexTable*> AllTable = CoveredTable;			//all the SSTables that will join the compaction
+	TRACE_SPAN(span, "compaction", order);
+	std::shared_ptr<const TableList> tables;		//SSTables of this level when compaction starts
+	{
+		std::lock_guard<std::mutex> lock(store->levelMutex);
+		tables = indextable;
+	}
+
+	bool tiered = store->opt.style == compactionStyle::tiered;
+	std::shared_ptr<const TableList> inputs = (tiered && seed == nullptr) ? tables : std::make_shared<const TableList>(pickInputs(*tables, seed));
+	compactPointer = 0;
+	for (TableList::const_iterator iter = inputs->begin(); iter != inputs->end(); iter++) {
+		compactPointer = std::max(compactPointer, (*iter)->largest);
+	}
 
-	for (std::list<IndexTable>::iterator iter = indextable->begin(); iter != indextable->end(); iter++) {
-		AllTable.push_front(&(*iter));
+	//SSTables overlapping neither the other inputs nor next level are moved down as they are
+	TableList MovedTable, MergedTable;
+	for (TableList::const_iterator iter = inputs->begin(); iter != inputs->end(); iter++) {
+		bool alone = seed == nullptr && !nextLevel->overlaps((*iter)->smallest, (*iter)->largest);
+		for (TableList::const_iterator other = inputs->begin(); alone && other != inputs->end(); other++) {
+			alone = other == iter || (*other)->smallest > (*iter)->largest || (*other)->largest < (*iter)->smallest;
+		}
+		(alone ? MovedTable : MergedTable).push_back(*iter);
 	}
 
-	std::vector<index> tmpIndexTable;			//all indexs contained in these SSTables
+	//outputs span the whole range of merged inputs, a SSTable inside it is merged as well
+	for (bool grown = !MergedTable.empty(); grown;) {
+		grown = false;
+		uint64_t minKey = UINT64_MAX, maxKey = 0;
+		for (TableList::const_iterator iter = MergedTable.begin(); iter != MergedTable.end(); iter++) {
+			minKey = std::min(minKey, (*iter)->smallest);
+			maxKey = std::max(maxKey, (*iter)->largest);
+		}
+
+		for (TableList::iterator iter = MovedTable.begin(); iter != MovedTable.end();) {
+			if ((*iter)->smallest <= maxKey && (*iter)->largest >= minKey) {
+				MergedTable.push_back(*iter);
+				iter = MovedTable.erase(iter);
+				grown = true;
+			}
+			else {
+				iter++;
+			}
+		}
+	}
+
+	TableList CoveredTable = tiered ? TableList() : findCoveredTable(MergedTable);
+	TableList AllTable = CoveredTable;			//all the SSTables that will join the compaction
 
-	for (std::list<IndexTable*>::iterator iter = AllTable.begin(); iter != AllTable.end(); iter++) {
-		std::vector<index>* tmp = &((*iter)->first);
-		for (std::vector<index>::iterator iter = tmp->begin(); iter != tmp->end(); iter++) {
-			tmpIndexTable.push_back(*iter);
+	TableList KeptTable;			//SSTables of next level not joining the compaction
+	for (TableList::const_iterator iter = nextLevel->indextable->begin(); iter != nextLevel->indextable->end(); iter++) {
+		if (std::find(CoveredTable.begin(), CoveredTable.end(), *iter) == CoveredTable.end()) {
+			KeptTable.push_back(*iter);
 		}
 	}
 
+	for (TableList::const_iterator iter = MergedTable.begin(); iter != MergedTable.end(); iter++) {
+		AllTable.push_front(*iter);
+	}
+
+	std::vector<index> tmpIndexTable;			//all indexs contained in these SSTables
+
+	for (TableList::iterator iter = AllTable.begin(); iter != AllTable.end(); iter++) {
+		std::shared_ptr<const std::vector<index>> tmp = (*iter)->load();
+		tmpIndexTable.insert(tmpIndexTable.end(), tmp->begin(), tmp->end());
+	}
+
 	std::sort(tmpIndexTable.begin(), tmpIndexTable.end());
-	merge(tmpIndexTable);
+	TRACE_ARG(span, tables, AllTable.size() + MovedTable.size());
+	TRACE_ARG(span, bytes, std::accumulate(AllTable.begin(), AllTable.end(), (uint64_t)0, [](uint64_t sum, const std::shared_ptr<const IndexTable> &t) { return sum + t->bytes; }));
+	std::map<uint64_t, std::string> folded;			//values of merge operands folded by merge
+	merge(tmpIndexTable, KeptTable, folded);
 
-	//create a SSTable in next level for every 2MB data
-	unsigned Size = 0;
-	quadlist<std::pair<uint64_t, std::string>> tmp;
-	for (std::vector<index>::iterator i = tmpIndexTable.begin(); i != tmpIndexTable.end(); i++) {
-		tmp.insert_back(std::pair(i->key, ReadFromSSTable(i->offset, levelPath.parent_path() / ("level" + std::to_string(i->level)) / (std::to_string(i->order) + ".dat"), i->size)));
-		Size += i->size;
-
-		if (Size >= 2097152) {
-			addSSTable(tmp, nextLevel);
-			tmp.clear();
+	//split at the first key of each covered SSTable, or each input of a tiered compaction, every part holds at least 2MB data
+	std::vector<uint64_t> boundaries;
+	const TableList &bounding = tiered ? MergedTable : CoveredTable;
+	for (TableList::const_iterator iter = bounding.begin(); iter != bounding.end(); iter++) {
+		boundaries.push_back((*iter)->smallest);
+	}
+	std::sort(boundaries.begin(), boundaries.end());
+
+	std::vector<std::vector<index>::const_iterator> parts(1, tmpIndexTable.begin());
+	uint64_t Size = 0;
+	std::vector<index>::const_iterator cur = tmpIndexTable.begin();
+	for (std::vector<uint64_t>::iterator b = boundaries.begin(); b != boundaries.end(); b++) {
+		std::vector<index>::const_iterator next = std::lower_bound(cur, tmpIndexTable.cend(), *b, [](const index &i, uint64_t key) { return i.key < key; });
+		for (; cur != next; cur++) {
+			Size += cur->inLog ? sizeof(index) : cur->size;
+		}
+
+		if (Size >= 2097152 && next != tmpIndexTable.end()) {
+			parts.push_back(next);
 			Size = 0;
 		}
 	}
+	parts.push_back(tmpIndexTable.end());
 
-	addSSTable(tmp, nextLevel);			//create a SSTable in next level for rest data
+	std::vector<std::future<TableList>> results;
+	for (unsigned part = 0; part + 1 < parts.size(); part++) {
+		std::vector<index>::const_iterator begin = parts[part], end = parts[part + 1];
+		results.push_back(store->pool->submit([this, begin, end, &folded] { return subcompaction(begin, end, folded); }));
+	}
 
-	//delete all indexs and SSTables that join the compaction in this level and next level
-	for (auto &iter:fs::directory_iterator(levelPath)) {
-		fs::remove_all(iter.path());
+	for (std::vector<std::future<TableList>>::iterator iter = results.begin(); iter != results.end(); iter++) {
+		iter->wait();			//all parts must finish before tmpIndexTable and folded go away
 	}
-	fs::create_directory(levelPath / "index");
-	indextable->clear();
-	size = 0;
-	minKey = 100000000;
-	maxKey = 0;
 
-	nextLevel->minKey = 100000000;
-	nextLevel->maxKey = 0;
-	for (std::list<IndexTable>::iterator iter = nextLevel->indextable->begin(); iter != nextLevel->indextable->end(); iter++) {
-		if (inTable(iter,CoveredTable)) {
-			fs::remove(iter->second);
-			iter = nextLevel->indextable->erase(iter);
-			nextLevel->size--;
-		}
-		else {
-			if (iter->first.front().key < nextLevel->minKey) {
-				nextLevel->minKey = iter->first.front().key;
-			}
+	//next level keeps the SSTables not covered and gets all the outputs
+	std::shared_ptr<TableList> nextTables = std::make_shared<TableList>(KeptTable);
+
+	for (std::vector<std::future<TableList>>::iterator iter = results.begin(); iter != results.end(); iter++) {
+		TableList outputs = iter->get();
+		nextTables->insert(nextTables->end(), outputs.begin(), outputs.end());
+	}
+
+	for (TableList::iterator iter = MovedTable.begin(); iter != MovedTable.end(); iter++) {
+		nextTables->push_back(nextLevel->moveTable(**iter));
+		AllTable.push_back(*iter);
+	}
+
+	//delete all SSTables that join the compaction in this level and next level
+	for (TableList::iterator iter = AllTable.begin(); iter != AllTable.end(); iter++) {
+		(*iter)->file->obsolete = true;
+	}
 
-			if (iter->first.back().key > nextLevel->maxKey) {
-				nextLevel->maxKey = iter->first.back().key;
+	//SSTables flushed into this level meanwhile are kept
+	{
+		std::lock_guard<std::mutex> lock(store->levelMutex);
+		std::shared_ptr<TableList> remaining = std::make_shared<TableList>();
+		for (TableList::const_iterator iter = indextable->begin(); iter != indextable->end(); iter++) {
+			if (std::find(inputs->begin(), inputs->end(), *iter) == inputs->end()) {
+				remaining->push_back(*iter);
 			}
 		}
-	}
 
-	nextLevel->renaming();
+		indextable = remaining;
+		size = remaining->size();
+		nextLevel->indextable = nextTables;
+		nextLevel->size = nextTables->size();
+	}
+	store->publish();
+	TRACE_SPAN_END(span);
 
-	if (nextLevel->size > nextLevel->capacity) {
+	while (nextLevel->size > nextLevel->capacity) {
 		nextLevel->compaction();
 	}
 }
 
 /**
-* Restore index from disk 
+* Restore index from disk
 * Read index infomation in each level and write it
 * to indextable of each level
+* File numbers and sequence numbers continue after the largest ones found.
 */
 void level::restoreIndex() {
+	TRACE_SPAN(span, "restoreIndex", order);
+	std::shared_ptr<TableList> tables = std::make_shared<TableList>();
+
 	for (auto &iter : fs::directory_iterator(levelPath / "index")) {
-		std::ifstream inFile(iter.path().string(), std::ios::in | std::ios::binary);
-		std::vector<index> indexlist;
-		index tmp;
+		if (iter.path().extension() != ".dat" || fs::file_size(iter.path()) == 0) {			//unfinished index write
+			continue;
+		}
 
-		//read each item and refresh minKey and maxKey
-		while (inFile.read((char*)&tmp, sizeof(tmp))) {
-			indexlist.push_back(tmp);
+		std::vector<index> indexlist = readIndexFile(iter.path());
 
-			if (tmp.key > maxKey) {
-				maxKey = tmp.key;
+		//refresh sequence number
+		for (std::vector<index>::iterator tmp = indexlist.begin(); tmp != indexlist.end(); tmp++) {
+			if (tmp->sequence > store->sequence) {
+				store->sequence = tmp->sequence;
 			}
+		}
 
-			if (tmp.key < minKey) {
-				minKey = tmp.key;
-			}
+		if (indexlist.empty()) {
+			continue;
 		}
 
-		indextable->push_back(IndexTable(indexlist, levelPath / (std::to_string(tmp.order) + ".dat")));
-		size++;
+		uint64_t number = std::stoull(iter.path().stem().string());
+		if (number >= store->nextFile) {
+			store->nextFile = number + 1;
+		}
+
+		tables->push_back(makeTable(indexlist, levelPath / iter.path().filename()));
 	}
+
+	indextable = tables;
+	size = tables->size();
+	TRACE_ARG(span, tables, size);
 }
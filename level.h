@@ -1,74 +1,301 @@
 #pragma once
 
 #include <list>
+#include <map>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <ctime>
+#include <mutex>
+#include <string_view>
 #include "quadlist.h"
+#include "ratelimiter.h"
+#include "learnedindex.h"
+#include "eytzingerindex.h"
+#include "lrucache.h"
+#include "options.h"
+#include "perfcontext.h"
 
 namespace fs = std::filesystem;
 
+class KVStore;
+
+class memTableRep;
+
 //index about a pair
 struct index{
 	uint64_t key, offset, size, order, level;
 
-	clock_t timeStamp;
+	uint64_t sequence;		//sequence number of the write, larger is newer
 
 	bool flag;
 
+	bool inLog;		//the value lives in the value log, offset and size point into logFile
+
+	bool operand;		//the value is a merge operand to fold into older values of key
+
+	uint32_t logFile;
+
+	uint64_t expire;		//wall clock second the pair expires at, 0 if it never expires
+
 	index(){}
 
-	index(uint64_t k, uint64_t o, uint64_t s, uint64_t ord, uint64_t l):key(k),offset(o),size(s),order(ord),level(l),timeStamp(clock()),flag(false){}
+	index(uint64_t k, uint64_t o, uint64_t s, uint64_t ord, uint64_t l):key(k),offset(o),size(s),order(ord),level(l),sequence(0),flag(false),inLog(false),operand(false),logFile(0),expire(0){}
+
+	bool expired() const{		//whether the pair has expired by now
+		return expire != 0 && expire <= (uint64_t)time(nullptr);
+	}
+
+	bool dead() const{		//deleted or expired, reads as not found
+		return flag || expired();
+	}
 
 	//operator< overload for sorting
-	bool operator<(const index &i){
+	bool operator<(const index &i) const{
 		return key < i.key;
 	}
 };
 
+//an entry to be written into SSTable, value is empty if it lives in the value log
+typedef std::pair<index, std::string> record;
+
+/**
+ * Header at the start of every index file, the indexs follow it as raw
+ * records. A file without it, or written with another layout of index,
+ * is refused instead of being misread.
+ */
+struct indexFileHeader{
+	static const uint64_t MAGIC = 0x5845444e494d534cULL;		//"LSMINDEX" in little endian
+	static const uint32_t VERSION = 1;		//layout of index, bumped whenever it changes
+
+	uint64_t magic;
+	uint32_t version;
+	uint32_t entrySize;		//sizeof(index) of the writer
+
+	indexFileHeader():magic(MAGIC),version(VERSION),entrySize(sizeof(index)){}
+};
+
+void writeIndexHeader(std::ostream &out);		//start an index file
+
+void readIndexHeader(std::istream &in, const fs::path &p);		//check the header of index file p
+
+void writeIndexFile(const fs::path &p, const std::vector<index> &l);		//write an index file as a whole
+
+std::vector<index> readIndexFile(const fs::path &p);		//read all the indexs of an index file
+
+/**
+ * A region of a file mapped into memory read only.
+ * The mapping outlives removal of the file, it is unmapped when the
+ * object is destroyed.
+ */
+struct mappedFile{
+	const char *data;		//first byte of the region
+	uint64_t size;		//length of the region
+
+	mappedFile(const fs::path &p, uint64_t offset, uint64_t length);
+
+	mappedFile(const fs::path &p);		//map the whole file
+
+	~mappedFile();
+
+	mappedFile(const mappedFile&) = delete;
+	mappedFile &operator=(const mappedFile&) = delete;
+
+	private:
+		void *base;		//page aligned start of the mapping
+		uint64_t mapSize;		//length of the mapping
+};
+
+/**
+ * A value pinned in memory, valid until released or destroyed.
+ * The view points into a mapped SSTable or value log file, whose
+ * mapping is kept alive by handle.
+ */
+class pinnedSlice{
+
+	std::string_view view;
+	std::shared_ptr<const void> handle;
+
+	public:
+		pinnedSlice(){}
+
+		pinnedSlice(std::string_view v, std::shared_ptr<const void> h):view(v),handle(h){}
+
+		std::string_view value() const {
+			return view;
+		}
+
+		std::string ToString() const {		//copy the value out
+			return std::string(view);
+		}
+
+		void release(){		//unpin the value
+			view = std::string_view();
+			handle.reset();
+		}
+};
+
+/**
+ * Owner of the data file of a SSTable and its index file, shared by all
+ * the index tables of the SSTable. Once compaction replaces the SSTable
+ * it is marked obsolete, and the files are removed when the last index
+ * table lets go of it.
+ */
+struct tableFile{
+	const fs::path path;		//the data file
+
+	mutable std::atomic<bool> obsolete;
+
+	tableFile(const fs::path &p):path(p),obsolete(false){}
+
+	~tableFile();
+
+	tableFile(const tableFile&) = delete;
+	tableFile &operator=(const tableFile&) = delete;
+};
+
+//index partitions cached by (table id, partition number)
+typedef lruCache<std::pair<uint64_t, uint64_t>, std::vector<index>> partitionCache;
+
+/**
+ * Index of a SSTable and its path.
+ * It is shared by all the versions containing the SSTable and never
+ * modified once published. Its files are removed through their owner,
+ * shared with the other index tables of the same SSTable.
+ * A partitioned index keeps only the first key of each partition in
+ * memory, partitions are read from the index file through the cache.
+ */
+struct IndexTable : public std::pair<std::vector<index>, fs::path>{
+	std::shared_ptr<const tableFile> file;		//owner of the files
+
+	uint64_t bytes;		//bytes a compaction has to rewrite for the SSTable
+
+	uint64_t count;		//number of indexs
+
+	uint64_t deleted;		//number of deleted indexs
+
+	uint64_t smallest, largest;		//range of keys
+
+	mutable std::shared_ptr<const mappedFile> mapped;		//the SSTable mapped on first pinned read
+
+	mutable std::once_flag mapOnce;
+
+	learnedIndex model;		//built only if the table is searched by a learned model
+
+	eytzingerIndex tree;		//built only if the table is searched by a static B+-tree
+
+	uint64_t id;		//identify partitions of this table in cache
+
+	uint64_t partitionSize;		//indexs per partition, 0 if all indexs are resident in first
+
+	std::vector<uint64_t> partitions;		//first key of each partition
+
+	std::shared_ptr<partitionCache> cache;
+
+	IndexTable(const std::vector<index> &i, const fs::path &p, indexSearch s = indexSearch::binary, uint64_t n = 0, std::shared_ptr<partitionCache> c = nullptr, std::shared_ptr<const tableFile> f = nullptr);
+
+	bool search(uint64_t key, index &result) const;		//find index of key, return false if not found
+
+	std::vector<index> range(uint64_t min, uint64_t max) const;		//indexs of keys in [min, max]
+
+	std::shared_ptr<const std::vector<index>> load() const;		//all the indexs
+
+	std::shared_ptr<const std::vector<index>> partition(uint64_t p) const;		//the p-th partition
+
+	uint64_t memoryUsage() const {		//bytes of the index table held in memory, cached partitions excluded
+		return sizeof(IndexTable) + first.capacity() * sizeof(index) + partitions.capacity() * sizeof(uint64_t) + model.memoryUsage() + tree.memoryUsage();
+	}
+
+	fs::path indexPath() const {		//path of the index file
+		return second.parent_path() / "index" / second.filename();
+	}
+
+	std::shared_ptr<const mappedFile> map() const{		//map the SSTable once
+		std::call_once(mapOnce, [this] { PERF_COUNT(fileOpens, 1); mapped = std::make_shared<const mappedFile>(second); });
+		return mapped;
+	}
+
+	~IndexTable();
+};
+
+//SSTables of a level, never modified once published
+typedef std::list<std::shared_ptr<const IndexTable>> TableList;
+
 class level{
 
-	typedef std::pair<std::vector<index>, fs::path> IndexTable;
 	typedef std::list<level>::iterator Iter;
 
-	friend void addSSTable(const quadlist<std::pair<uint64_t, std::string>> &l, level *le);
+	friend void addSSTable(const memTableRep &m, level *le);
+	friend void addSSTable(const std::vector<record> &l, level *le, rateLimiter::priority p);
 
 	protected:
 		uint64_t order;
 		const fs::path levelPath;     //filepath of the level
 		uint64_t capacity;      //capacity of the level(number of SSTable)
 		uint64_t size;          //current size of the level
-		std::shared_ptr<std::list<IndexTable>> indextable;      //index table for all SSTable in the level
+		std::shared_ptr<const TableList> indextable;      //index table for all SSTable in the level, latest one seen by writer
 		level *nextLevel;		//do compaction with this level
-		uint64_t maxKey;		//maximum key in this level
-		uint64_t minKey;		//minimum key in this level
+		KVStore *store;		//the store this level belongs to
+		uint64_t compactPointer;		//largest key of the last compaction, the next one starts after it
 
         int binarySearch(const std::vector<index> &l, uint64_t key) const;      //binary search in index list
 
-        std::string ReadFromSSTable(uint64_t offset, fs::path name, uint64_t size) const;       //read value from SSTable according to offset
+		TableList pickInputs(const TableList &tables, std::shared_ptr<const IndexTable> seed = nullptr) const;		//SSTables of tables to compact next
 
-		std::list<IndexTable*> findCoveredTable() const;		//find all the SSTable in the nextlevel that is covered by the range 
+		TableList findCoveredTable(const TableList &inputs) const;		//find all the SSTable in the nextlevel that is covered by the range of inputs
 
-		void merge(std::vector<index> &tmpIndexTable);			//merge all the index that has same key by timeStamp
+		bool coveredBelow(uint64_t key, const TableList &kept) const;		//whether a SSTable not joining the compaction may hold the key
 
-		bool inTable(std::list<IndexTable>::iterator &iter, std::list<IndexTable*> &l) const;		//whether the iter is in table
+		void merge(std::vector<index> &tmpIndexTable, const TableList &kept, std::map<uint64_t, std::string> &folded);			//merge all the index that has same key by sequence
 
-		void renaming();		//renaming all SSTable in this level
+		fs::path tablePath(const index &i) const {		//path of the SSTable holding i
+			return levelPath.parent_path() / ("level" + std::to_string(i.level)) / (std::to_string(i.order) + ".dat");
+		}
+
+		std::shared_ptr<const IndexTable> makeTable(const std::vector<index> &l, const fs::path &p, std::shared_ptr<const tableFile> f = nullptr) const;		//index table searched as the store is configured
+
+		std::shared_ptr<const IndexTable> writeTable(const std::vector<record> &l, uint64_t number, rateLimiter::priority p) const;		//write records into a new SSTable
+
+		std::shared_ptr<const IndexTable> moveTable(const IndexTable &t) const;		//take over a SSTable of the level above
+
+		TableList subcompaction(std::vector<index>::const_iterator begin, std::vector<index>::const_iterator end, const std::map<uint64_t, std::string> &folded) const;		//compact a key range into next level
 
     public:
-		level(uint64_t o, const fs::path &p, uint64_t c, uint64_t s, level *l = nullptr):order(o),levelPath(p),capacity(c),size(s),indextable(std::make_shared<std::list<IndexTable>>(std::list<IndexTable>())),nextLevel(l),maxKey(0),minKey(100000000){}
+		level(uint64_t o, const fs::path &p, uint64_t c, uint64_t s, level *l = nullptr, KVStore *st = nullptr):order(o),levelPath(p),capacity(c),size(s),indextable(std::make_shared<const TableList>()),nextLevel(l),store(st),compactPointer(0){}
 
         ~level(){}
 
-        std::string get(uint64_t key) const;        //get value from the SSTable in the level
+        std::string ReadFromSSTable(uint64_t offset, fs::path name, uint64_t size) const;       //read value from SSTable according to offset
+
+		std::string readValue(const index &i, const fs::path &name, bool *found = nullptr) const;		//read value from SSTable or value log
+
+		pinnedSlice pinValue(const index &i, const IndexTable &table, bool *found = nullptr) const;		//pin value in mapped SSTable or value log
+
+		bool find(const TableList &tables, uint64_t key, index &result, fs::path *name = nullptr, std::shared_ptr<const IndexTable> *table = nullptr) const;		//find the latest index of key in the level
+
+		void findAll(const TableList &tables, uint64_t key, std::vector<std::pair<index, fs::path>> &result) const;		//all the indexs of key in the level
+
+		void range(const TableList &tables, uint64_t min, uint64_t max, std::map<uint64_t, std::pair<index, fs::path>> &result) const;		//latest indexs of keys in [min, max]
+
+		bool overlaps(uint64_t min, uint64_t max) const;		//whether any SSTable holds keys in [min, max]
 
-		bool del(uint64_t key);		//lazy delete 
+		void ingestTable(const fs::path &p, std::vector<index> l, uint64_t stamp);		//take over an externally built SSTable
 
-		void compaction();		//do compaction when the level overflow
+		void compaction(std::shared_ptr<const IndexTable> seed = nullptr);		//compact some SSTables, or seed, into next level
 
 		void restoreIndex();		//restore index from disk to memory
 
+		std::shared_ptr<const TableList> Tables() const {
+			return indextable;
+		}
+
+		uint64_t Order() const {
+			return order;
+		}
+
 		uint64_t Size() const {
 			return size;
 		}
@@ -76,4 +303,4 @@ class level{
 		uint64_t Capacity() const {
 			return capacity;
 		}
-};
\ No newline at end of file
+};
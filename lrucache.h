@@ -0,0 +1,108 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <memory>
+
+/**********************************************************************
+ * lruCache
+ * thread safe cache of immutable values bounded by the total charge,
+ * the least recently used values are evicted first. Values handed out
+ * stay valid after eviction since they are shared
+ * *******************************************************************/
+template<typename key, typename value>
+class lruCache{
+
+    typedef std::shared_ptr<const value> Ptr;
+
+    //a cached value with its charge
+    struct entry{
+        key k;
+        Ptr v;
+        uint64_t charge;
+    };
+
+    typedef typename std::list<entry>::iterator Iter;
+
+    public:
+        lruCache(uint64_t c):capacity(c),usage(0){}     //cache at most c charge
+        lruCache(const lruCache&) = delete;
+        lruCache &operator=(const lruCache&) = delete;
+        Ptr find(const key&);           //look up and refresh a value, nullptr if missing
+        void insert(const key&, Ptr, uint64_t charge);      //add or replace a value
+        void erase(const key&);         //drop a value
+        uint64_t Usage(){               //total charge of cached values
+            std::lock_guard<std::mutex> lock(mtx);
+            return usage;
+        }
+        void setCapacity(uint64_t c){       //resize, evicting until usage fits
+            std::lock_guard<std::mutex> lock(mtx);
+            capacity = c;
+            evict();
+        }
+
+    private:
+        uint64_t capacity;
+        uint64_t usage;
+        std::list<entry> entries;       //most recently used first
+        std::map<key, Iter> positions;      //position of each key in entries
+        std::mutex mtx;
+
+        void evict();           //evict until usage fits capacity
+};
+
+//definition of find
+template<typename key, typename value>
+typename lruCache<key, value>::Ptr lruCache<key, value>::find(const key &k){
+    std::lock_guard<std::mutex> lock(mtx);
+    typename std::map<key, Iter>::iterator position = positions.find(k);
+    if(position == positions.end()){
+        return nullptr;
+    }
+
+    entries.splice(entries.begin(), entries, position->second);
+    return position->second->v;
+}
+
+//definition of insert
+template<typename key, typename value>
+void lruCache<key, value>::insert(const key &k, Ptr v, uint64_t charge){
+    std::lock_guard<std::mutex> lock(mtx);
+    typename std::map<key, Iter>::iterator position = positions.find(k);
+    if(position != positions.end()){
+        usage -= position->second->charge;
+        entries.erase(position->second);
+        positions.erase(position);
+    }
+
+    entries.push_front(entry{k, v, charge});
+    positions[k] = entries.begin();
+    usage += charge;
+    evict();
+}
+
+//definition of erase
+template<typename key, typename value>
+void lruCache<key, value>::erase(const key &k){
+    std::lock_guard<std::mutex> lock(mtx);
+    typename std::map<key, Iter>::iterator position = positions.find(k);
+    if(position != positions.end()){
+        usage -= position->second->charge;
+        entries.erase(position->second);
+        positions.erase(position);
+    }
+}
+
+//definition of evict
+template<typename key, typename value>
+void lruCache<key, value>::evict(){
+    while(usage > capacity && !entries.empty()){
+        usage -= entries.back().charge;
+        positions.erase(entries.back().k);
+        entries.pop_back();
+    }
+}
+
+#endif
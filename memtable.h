@@ -0,0 +1,453 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include "skiplist.h"
+#include "options.h"
+
+/**
+ * Representation of the memtable, the latest value of each key written
+ * since the last flush.
+ * put replaces the value of a key already present. range visits the
+ * pairs with key in [min, max] in increasing order of key. find and
+ * range may run concurrently with each other, but not with the others.
+ * Representations are picked by options::memtable.
+ * memoryUsage counts the bytes of keys, values and the structure holding
+ * them, allocator overhead excluded.
+ */
+class memTableRep{
+	protected:
+		static uint64_t heapBytes(const std::string &s){		//bytes s allocates out of itself
+			const char *inside = (const char*)&s;
+			bool local = s.data() >= inside && s.data() < inside + sizeof(s);		//short strings live in the object
+			return local ? 0 : s.capacity() + 1;
+		}
+
+	public:
+		virtual ~memTableRep(){}
+
+		virtual uint64_t put(uint64_t key, const std::string &value) = 0;		//size of the replaced value given back, 0 if none or still held
+
+		virtual const std::string *find(uint64_t key) const = 0;		//value of key, nullptr if not found
+
+		virtual uint64_t remove(uint64_t key) = 0;		//size of the removed value, 0 if not found
+
+		virtual void range(uint64_t min, uint64_t max, const std::function<void(uint64_t, const std::string&)> &f) const = 0;
+
+		virtual void clear() = 0;
+
+		virtual uint64_t size() const = 0;		//number of pairs held, replaced ones included if still held
+
+		virtual uint64_t memoryUsage() const = 0;		//bytes held
+
+		virtual const char *name() const = 0;
+};
+
+//the skiplist, keys must stay below MAX_TAG
+class skipListRep : public memTableRep{
+
+	typedef quadnode<std::pair<uint64_t, std::string>> node;
+
+	skiplist<uint64_t, std::string> list;
+	uint64_t bytes = 0;		//bytes of the towers
+
+	static uint64_t towerBytes(node *top){		//every node of a tower holds a copy of the pair
+		uint64_t result = 0;
+		for (; top != nullptr; top = top->below) {
+			result += sizeof(node) + heapBytes((top->data).second);
+		}
+		return result;
+	}
+
+	public:
+		uint64_t put(uint64_t key, const std::string &value) override {
+			uint64_t result = remove(key);		//skiplist keeps duplicates
+			list.put(key, value);
+			bytes += towerBytes(list.find(key));
+			return result;
+		}
+
+		const std::string *find(uint64_t key) const override {
+			node *position = list.find(key);
+			return position == nullptr ? nullptr : &(position->data).second;
+		}
+
+		uint64_t remove(uint64_t key) override {
+			node *top = list.find(key);
+			if (top == nullptr) {
+				return 0;
+			}
+			bytes -= towerBytes(top);
+			return list.remove(key);
+		}
+
+		void range(uint64_t min, uint64_t max, const std::function<void(uint64_t, const std::string&)> &f) const override {
+			for (node *tmp = list.pairList().first()->next; !isTailer(tmp) && (tmp->data).first <= max; tmp = tmp->next) {
+				if ((tmp->data).first >= min) {
+					f((tmp->data).first, (tmp->data).second);
+				}
+			}
+		}
+
+		void clear() override {
+			list.clear();
+			bytes = 0;
+		}
+
+		uint64_t size() const override {
+			return list.size();
+		}
+
+		uint64_t memoryUsage() const override {		//a header and a tailer per layer besides the towers
+			return sizeof(*this) + bytes + list.level() * 2 * sizeof(node);
+		}
+
+		const char *name() const override {
+			return "skiplist";
+		}
+};
+
+//a red-black tree of the standard library
+class treeRep : public memTableRep{
+
+	static const uint64_t nodeBytes = 4 * sizeof(void*) + sizeof(std::pair<const uint64_t, std::string>);		//color and links besides the pair
+
+	std::map<uint64_t, std::string> pairs;
+	uint64_t bytes = 0;		//bytes of the nodes
+
+	public:
+		uint64_t put(uint64_t key, const std::string &value) override {
+			std::map<uint64_t, std::string>::iterator iter = pairs.find(key);
+			uint64_t result = 0;
+			if (iter == pairs.end()) {
+				iter = pairs.emplace(key, std::string()).first;
+				bytes += nodeBytes;
+			}
+			else {
+				result = iter->second.size();
+				bytes -= heapBytes(iter->second);
+			}
+			iter->second = value;
+			bytes += heapBytes(iter->second);
+			return result;
+		}
+
+		const std::string *find(uint64_t key) const override {
+			std::map<uint64_t, std::string>::const_iterator iter = pairs.find(key);
+			return iter == pairs.end() ? nullptr : &iter->second;
+		}
+
+		uint64_t remove(uint64_t key) override {
+			std::map<uint64_t, std::string>::iterator iter = pairs.find(key);
+			if (iter == pairs.end()) {
+				return 0;
+			}
+			uint64_t result = iter->second.size();
+			bytes -= nodeBytes + heapBytes(iter->second);
+			pairs.erase(iter);
+			return result;
+		}
+
+		void range(uint64_t min, uint64_t max, const std::function<void(uint64_t, const std::string&)> &f) const override {
+			for (std::map<uint64_t, std::string>::const_iterator iter = pairs.lower_bound(min); iter != pairs.end() && iter->first <= max; iter++) {
+				f(iter->first, iter->second);
+			}
+		}
+
+		void clear() override {
+			pairs.clear();
+			bytes = 0;
+		}
+
+		uint64_t size() const override {
+			return pairs.size();
+		}
+
+		uint64_t memoryUsage() const override {
+			return sizeof(*this) + bytes;
+		}
+
+		const char *name() const override {
+			return "tree";
+		}
+};
+
+/**
+ * Pairs appended in the order of writes, for write-heavy bursts such as
+ * bulk loading. put never looks for the key, appended pairs wait in a
+ * short tail which is sorted into a new run once full. Runs are merged
+ * while a run is not more than twice as large as the newer one, so there
+ * are a logarithmic number of them and a pair is moved a logarithmic
+ * number of times. A replaced pair is dropped by the merge. find scans
+ * the tail and binary searches every run, remove erases from them.
+ */
+class vectorRep : public memTableRep{
+
+	typedef std::pair<uint64_t, std::string> entry;
+
+	static const size_t tailSize = 128;		//pairs appended before sorting them into a run
+
+	std::vector<std::vector<entry>> runs;		//each sorted by key with one pair per key, the newest last
+	std::vector<entry> tail;		//in the order of writes, a key may repeat
+	uint64_t bytes = 0;		//bytes of values out of pairs
+
+	static bool less(const entry &a, const entry &b){
+		return a.first < b.first;
+	}
+
+	static std::vector<entry>::const_iterator locate(const std::vector<entry> &run, uint64_t key){		//pair of key in run, end if none
+		std::vector<entry>::const_iterator iter = std::lower_bound(run.begin(), run.end(), entry(key, std::string()), less);
+		return (iter != run.end() && iter->first == key) ? iter : run.end();
+	}
+
+	void merge(std::vector<entry> &older, std::vector<entry> &newer){		//merge newer into older, the newer pair of a key wins
+		if (older.empty() || newer.empty() || newer.front().first > older.back().first) {
+			older.insert(older.end(), std::make_move_iterator(newer.begin()), std::make_move_iterator(newer.end()));
+			return;
+		}
+
+		std::vector<entry> merged;
+		merged.reserve(older.size() + newer.size());
+		std::vector<entry>::iterator o = older.begin();
+		for (std::vector<entry>::iterator n = newer.begin(); n != newer.end(); n++) {
+			for (; o != older.end() && o->first < n->first; o++) {
+				merged.push_back(std::move(*o));
+			}
+			if (o != older.end() && o->first == n->first) {
+				bytes -= heapBytes(o->second);
+				o++;
+			}
+			merged.push_back(std::move(*n));
+		}
+		merged.insert(merged.end(), std::make_move_iterator(o), std::make_move_iterator(older.end()));
+		older.swap(merged);
+	}
+
+	void fold(){		//sort the tail into a new run, then merge runs of close sizes
+		std::stable_sort(tail.begin(), tail.end(), less);
+		std::vector<entry> run;
+		for (size_t t = 0; t < tail.size(); t++) {
+			if (t + 1 < tail.size() && tail[t + 1].first == tail[t].first) {		//replaced within the tail
+				bytes -= heapBytes(tail[t].second);
+				continue;
+			}
+			run.push_back(std::move(tail[t]));
+		}
+		tail.clear();
+		runs.push_back(std::move(run));
+
+		while (runs.size() > 1 && runs[runs.size() - 2].size() <= 2 * runs.back().size()) {
+			merge(runs[runs.size() - 2], runs.back());
+			runs.pop_back();
+		}
+	}
+
+	public:
+		uint64_t put(uint64_t key, const std::string &value) override {
+			tail.push_back(entry(key, value));
+			bytes += heapBytes(tail.back().second);
+			if (tail.size() >= tailSize) {
+				fold();
+			}
+			return 0;
+		}
+
+		const std::string *find(uint64_t key) const override {
+			for (std::vector<entry>::const_reverse_iterator iter = tail.rbegin(); iter != tail.rend(); iter++) {
+				if (iter->first == key) {
+					return &iter->second;
+				}
+			}
+			for (std::vector<std::vector<entry>>::const_reverse_iterator run = runs.rbegin(); run != runs.rend(); run++) {
+				std::vector<entry>::const_iterator position = locate(*run, key);
+				if (position != run->end()) {
+					return &position->second;
+				}
+			}
+			return nullptr;
+		}
+
+		uint64_t remove(uint64_t key) override {		//all the pairs of key go, the size of the latest is returned
+			const std::string *latest = find(key);
+			if (latest == nullptr) {
+				return 0;
+			}
+			uint64_t result = latest->size();
+
+			for (std::vector<entry>::const_iterator iter = tail.begin(); iter != tail.end(); iter++) {
+				bytes -= iter->first == key ? heapBytes(iter->second) : 0;
+			}
+			tail.erase(std::remove_if(tail.begin(), tail.end(), [key](const entry &p) { return p.first == key; }), tail.end());
+
+			for (std::vector<std::vector<entry>>::iterator run = runs.begin(); run != runs.end(); run++) {
+				std::vector<entry>::const_iterator position = locate(*run, key);
+				if (position != run->end()) {
+					bytes -= heapBytes(position->second);
+					run->erase(position);
+				}
+			}
+			return result;
+		}
+
+		void range(uint64_t min, uint64_t max, const std::function<void(uint64_t, const std::string&)> &f) const override {
+			std::vector<std::vector<const entry*>> sources(1);		//pairs in range of the tail and of each run, the newest first
+
+			for (std::vector<entry>::const_iterator iter = tail.begin(); iter != tail.end(); iter++) {
+				if (iter->first >= min && iter->first <= max) {
+					sources[0].push_back(&*iter);
+				}
+			}
+			std::stable_sort(sources[0].begin(), sources[0].end(), [](const entry *a, const entry *b) { return a->first < b->first; });
+			std::reverse(sources[0].begin(), sources[0].end());		//the latest pair of a key comes first, and is the only one kept
+			sources[0].erase(std::unique(sources[0].begin(), sources[0].end(), [](const entry *a, const entry *b) { return a->first == b->first; }), sources[0].end());
+			std::reverse(sources[0].begin(), sources[0].end());
+
+			for (std::vector<std::vector<entry>>::const_reverse_iterator run = runs.rbegin(); run != runs.rend(); run++) {
+				sources.push_back(std::vector<const entry*>());
+				for (std::vector<entry>::const_iterator iter = std::lower_bound(run->begin(), run->end(), entry(min, std::string()), less); iter != run->end() && iter->first <= max; iter++) {
+					sources.back().push_back(&*iter);
+				}
+			}
+
+			std::vector<size_t> heads(sources.size(), 0);
+			while (true) {
+				const entry *next = nullptr;		//smallest key left, from the newest source holding it
+				for (size_t s = 0; s < sources.size(); s++) {
+					if (heads[s] < sources[s].size() && (next == nullptr || sources[s][heads[s]]->first < next->first)) {
+						next = sources[s][heads[s]];
+					}
+				}
+				if (next == nullptr) {
+					break;
+				}
+
+				for (size_t s = 0; s < sources.size(); s++) {
+					if (heads[s] < sources[s].size() && sources[s][heads[s]]->first == next->first) {
+						heads[s]++;
+					}
+				}
+				f(next->first, next->second);
+			}
+		}
+
+		void clear() override {
+			runs.clear();
+			tail.clear();
+			bytes = 0;
+		}
+
+		uint64_t size() const override {
+			uint64_t result = tail.size();
+			for (std::vector<std::vector<entry>>::const_iterator run = runs.begin(); run != runs.end(); run++) {
+				result += run->size();
+			}
+			return result;
+		}
+
+		uint64_t memoryUsage() const override {
+			uint64_t result = sizeof(*this) + runs.capacity() * sizeof(runs[0]) + tail.capacity() * sizeof(entry) + bytes;
+			for (std::vector<std::vector<entry>>::const_iterator run = runs.begin(); run != runs.end(); run++) {
+				result += run->capacity() * sizeof(entry);
+			}
+			return result;
+		}
+
+		const char *name() const override {
+			return "vector";
+		}
+};
+
+/**
+ * Pairs in a hash table, sorted only by range, for phases heavy with
+ * point lookups of recent writes.
+ */
+class hashRep : public memTableRep{
+
+	static const uint64_t nodeBytes = sizeof(void*) + sizeof(std::pair<const uint64_t, std::string>);		//link besides the pair
+
+	std::unordered_map<uint64_t, std::string> pairs;
+	uint64_t bytes = 0;		//bytes of the nodes
+
+	public:
+		uint64_t put(uint64_t key, const std::string &value) override {
+			std::unordered_map<uint64_t, std::string>::iterator iter = pairs.find(key);
+			uint64_t result = 0;
+			if (iter == pairs.end()) {
+				iter = pairs.emplace(key, std::string()).first;
+				bytes += nodeBytes;
+			}
+			else {
+				result = iter->second.size();
+				bytes -= heapBytes(iter->second);
+			}
+			iter->second = value;
+			bytes += heapBytes(iter->second);
+			return result;
+		}
+
+		const std::string *find(uint64_t key) const override {
+			std::unordered_map<uint64_t, std::string>::const_iterator iter = pairs.find(key);
+			return iter == pairs.end() ? nullptr : &iter->second;
+		}
+
+		uint64_t remove(uint64_t key) override {
+			std::unordered_map<uint64_t, std::string>::iterator iter = pairs.find(key);
+			if (iter == pairs.end()) {
+				return 0;
+			}
+			uint64_t result = iter->second.size();
+			bytes -= nodeBytes + heapBytes(iter->second);
+			pairs.erase(iter);
+			return result;
+		}
+
+		void range(uint64_t min, uint64_t max, const std::function<void(uint64_t, const std::string&)> &f) const override {
+			std::vector<const std::pair<const uint64_t, std::string>*> order;
+			for (std::unordered_map<uint64_t, std::string>::const_iterator iter = pairs.begin(); iter != pairs.end(); iter++) {
+				if (iter->first >= min && iter->first <= max) {
+					order.push_back(&*iter);
+				}
+			}
+			std::sort(order.begin(), order.end(), [](const std::pair<const uint64_t, std::string> *a, const std::pair<const uint64_t, std::string> *b) { return a->first < b->first; });
+
+			for (size_t o = 0; o < order.size(); o++) {
+				f(order[o]->first, order[o]->second);
+			}
+		}
+
+		void clear() override {
+			pairs.clear();
+			bytes = 0;
+		}
+
+		uint64_t size() const override {
+			return pairs.size();
+		}
+
+		uint64_t memoryUsage() const override {		//buckets besides the nodes
+			return sizeof(*this) + bytes + pairs.bucket_count() * sizeof(void*);
+		}
+
+		const char *name() const override {
+			return "hash";
+		}
+};
+
+//new empty memtable of representation t
+inline std::shared_ptr<memTableRep> makeMemTable(memTableType t){
+	switch (t) {
+		case memTableType::tree:
+			return std::make_shared<treeRep>();
+		case memTableType::vector:
+			return std::make_shared<vectorRep>();
+		case memTableType::hash:
+			return std::make_shared<hashRep>();
+		default:
+			return std::make_shared<skipListRep>();
+	}
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <set>
+#include <memory>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+#include "memtable.h"
+
+/**
+ * Microbenchmark of memtable representations.
+ * Usage: memtablebench [writes] [lookups] [value size]...
+ * Runs puts and a full range scan of every key, then finds and removes
+ * of the first lookups keys, against each representation, for
+ * sequential, random and duplicate-heavy keys at each value size.
+ * Reports nanoseconds per operation, allocations per put and heap bytes
+ * per distinct key, measured and as accounted by memoryUsage.
+ * Allocations are counted by replacing the global allocation functions
+ * of this program, every form of operator new paired with the forms of
+ * operator delete releasing it.
+ */
+
+static uint64_t allocations = 0;		//calls of operator new
+static int64_t heapBytes = 0;		//bytes allocated by operator new and not freed
+
+//count an allocation of n bytes aligned to align, nullptr if it fails
+static void *allocate(size_t n, size_t align) {
+	void *p = align <= alignof(std::max_align_t) ? malloc(n == 0 ? 1 : n) : aligned_alloc(align, (n + align - 1) / align * align);
+	if (p != nullptr) {
+		allocations++;
+		heapBytes += malloc_usable_size(p);
+	}
+	return p;
+}
+
+//release memory of allocate
+static void release(void *p) {
+	if (p != nullptr) {
+		heapBytes -= malloc_usable_size(p);
+		free(p);
+	}
+}
+
+static void *allocateOrThrow(size_t n, size_t align) {
+	void *p = allocate(n, align);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new(size_t n) { return allocateOrThrow(n, 0); }
+void *operator new[](size_t n) { return allocateOrThrow(n, 0); }
+void *operator new(size_t n, std::align_val_t a) { return allocateOrThrow(n, (size_t)a); }
+void *operator new[](size_t n, std::align_val_t a) { return allocateOrThrow(n, (size_t)a); }
+void *operator new(size_t n, const std::nothrow_t&) noexcept { return allocate(n, 0); }
+void *operator new[](size_t n, const std::nothrow_t&) noexcept { return allocate(n, 0); }
+void *operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return allocate(n, (size_t)a); }
+void *operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return allocate(n, (size_t)a); }
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, size_t) noexcept { release(p); }
+void operator delete[](void *p, size_t) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept { release(p); }
+
+std::vector<uint64_t> makeKeys(const std::string &pattern, int writes, std::mt19937_64 &rng) {
+	std::vector<uint64_t> keys;
+	for (int i = 0; i < writes; i++) {
+		if (pattern == "sequential") {
+			keys.push_back(i + 1);
+		}
+		else if (pattern == "random") {
+			keys.push_back(rng() % (MAX_TAG - 1) + 1);
+		}
+		else {		//duplicate heavy, every key is written 8 times on average
+			keys.push_back(rng() % (writes / 8 + 1) + 1);
+		}
+	}
+	return keys;
+}
+
+double nanosSince(std::chrono::steady_clock::time_point start, uint64_t ops) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (ops == 0 ? 1 : ops);
+}
+
+void runSuite(memTableRep &rep, const std::string &pattern, const std::vector<uint64_t> &keys, size_t lookups, int valueSize) {
+	std::string value(valueSize, 'v');
+	uint64_t distinct = std::set<uint64_t>(keys.begin(), keys.end()).size();
+	lookups = std::min(lookups, keys.size());
+	int64_t heapBefore = heapBytes;
+	uint64_t allocationsBefore = allocations;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (std::vector<uint64_t>::const_iterator key = keys.begin(); key != keys.end(); key++) {
+		rep.put(*key, value);
+	}
+	double putNanos = nanosSince(start, keys.size());
+	double allocationsPerPut = (double)(allocations - allocationsBefore) / keys.size();
+	double bytesPerKey = (double)(heapBytes - heapBefore) / distinct;
+	double accountedPerKey = (double)rep.memoryUsage() / distinct;
+
+	uint64_t visited = 0;
+	start = std::chrono::steady_clock::now();
+	rep.range(0, MAX_TAG - 1, [&visited](uint64_t key, const std::string &v) { visited += v.size() != 0; });
+	double scanNanos = nanosSince(start, distinct);
+
+	uint64_t found = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t k = 0; k < lookups; k++) {
+		found += rep.find(keys[k]) != nullptr;
+	}
+	double findNanos = nanosSince(start, lookups);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t k = 0; k < lookups; k++) {
+		rep.remove(keys[k]);
+	}
+	double removeNanos = nanosSince(start, lookups);
+
+	if (found != lookups || visited != distinct) {
+		std::cerr << rep.name() << " lost pairs on " << pattern << " keys!" << std::endl;
+		exit(1);
+	}
+
+	std::cout << std::left << std::setw(10) << rep.name() << std::setw(12) << pattern << std::right << std::setw(7) << valueSize
+		<< std::fixed << std::setprecision(1) << std::setw(10) << putNanos << std::setw(10) << findNanos << std::setw(10) << scanNanos
+		<< std::setw(10) << removeNanos << std::setw(10) << std::setprecision(2) << allocationsPerPut << std::setw(12) << std::setprecision(1) << bytesPerKey << std::setw(12) << accountedPerKey << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+	int writes = argc > 1 ? atoi(argv[1]) : 100000;
+	size_t lookups = argc > 2 ? atoi(argv[2]) : 500;
+	std::vector<int> valueSizes;
+	for (int a = 3; a < argc; a++) {
+		valueSizes.push_back(atoi(argv[a]));
+	}
+	if (valueSizes.empty()) {
+		valueSizes = {16, 100, 1000};
+	}
+
+	memTableType types[] = {memTableType::skipList, memTableType::tree, memTableType::vector, memTableType::hash};
+
+	std::cout << "rep       keys          value    put ns   find ns   scan ns remove ns  allocs/put  bytes/key  accounted" << std::endl;
+	const char *patterns[] = {"sequential", "random", "duplicate"};
+	for (int p = 0; p < 3; p++) {
+		for (std::vector<int>::iterator size = valueSizes.begin(); size != valueSizes.end(); size++) {
+			for (int t = 0; t < 4; t++) {
+				std::mt19937_64 rng(2021);
+				std::vector<uint64_t> keys = makeKeys(patterns[p], writes, rng);
+				std::shared_ptr<memTableRep> rep = makeMemTable(types[t]);
+				runSuite(*rep, patterns[p], keys, lookups, *size);
+			}
+		}
+	}
+
+	return 0;
+}
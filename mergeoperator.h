@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Read-modify-write of values registered with a KVStore through options.
+ * merge applies operand to the existing value, existing is nullptr if the
+ * key has no value. Operands met before any value are combined with each
+ * other by the same call, the older one passed as existing, so merge has
+ * to be associative. It is called by readers and compaction concurrently.
+ */
+class mergeOperator{
+	public:
+		virtual ~mergeOperator(){}
+
+		virtual std::string merge(const std::string *existing, const std::string &operand) const = 0;
+};
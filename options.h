@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <thread>
+#include <memory>
+#include "mergeoperator.h"
+
+//how the index of a SSTable is searched for a key
+enum class indexSearch{
+	binary,		//binary search over the whole index
+	learned,		//binary search in the window predicted by a piecewise linear model
+	eytzinger		//descend a static B+-tree of cache line nodes in Eytzinger order
+};
+
+//how SSTables flow from a level into the next one
+enum class compactionStyle{
+	leveled,		//picked SSTables are merged with the SSTables they overlap in next level
+	tiered		//a full level is merged into one sorted run added to next level, beside its runs
+};
+
+//which SSTable of a level below level 0 is compacted next
+enum class compactionPriority{
+	roundRobin,		//the one after the key range compacted last time
+	minOverlap,		//the one with least bytes to rewrite in next level per byte of its own
+	tombstones		//the one with most deleted pairs per pair
+};
+
+//how the memtable holds pairs
+enum class memTableType{
+	skipList,		//sorted skiplist
+	tree,		//sorted red-black tree
+	vector,		//appended in write order and merged into sorted runs in batches, for write-heavy bursts
+	hash		//hash table sorted at flush, for point lookups of recent writes
+};
+
+//tunable parameters of a KVStore
+struct options{
+	uint64_t valueThreshold = 4096;		//values not smaller than this are separated into the value log
+
+	uint64_t logFileSize = 67108864;		//switch to a new value log file beyond this size
+
+	double gcRatio = 0.5;		//collect a value log file once its live ratio drops below this
+
+	unsigned compactionThreads = std::thread::hardware_concurrency();		//workers running subcompactions in parallel
+
+	unsigned readQueueDepth = 64;		//reads kept in flight by batched reads
+
+	bool useIoUring = true;		//submit batched reads through io_uring where the kernel supports it
+
+	uint64_t ioRateLimit = 0;		//bytes per second written and read by flush and compaction, 0 means unlimited
+
+	bool autoTuneRateLimit = false;		//let the rate follow the compaction backlog, bounded by ioRateLimit
+
+	unsigned l0SlowdownTables = 4;		//delay writes once level 0 holds this many SSTables
+
+	unsigned l0StopTables = 8;		//block writes once level 0 holds this many SSTables
+
+	uint64_t slowdownPendingBytes = 67108864;		//delay writes once compaction falls this many bytes behind
+
+	uint64_t stopPendingBytes = 268435456;		//block writes once compaction falls this many bytes behind
+
+	uint64_t delayedWriteRate = 16777216;		//bytes per second accepted right after the soft limits are crossed
+
+	indexSearch search = indexSearch::learned;		//search method of SSTable indexes
+
+	uint64_t indexPartitionEntries = 0;		//indexs per partition read from disk on demand, 0 keeps whole indexes in memory
+
+	uint64_t indexCacheSize = 8388608;		//bytes of index partitions cached in memory
+
+	double tombstoneRatio = 0.5;		//compact a SSTable early once this share of its pairs is deleted, 0 disables it
+
+	compactionStyle style = compactionStyle::leveled;		//less write amplification with tiered, less read and space amplification with leveled
+
+	compactionPriority pick = compactionPriority::minOverlap;		//SSTable picked by compaction below level 0, level 0 picks the oldest
+
+	uint64_t slowGetMicros = 1000;		//gets taking at least this many microseconds are traced
+
+	memTableType memtable = memTableType::skipList;		//representation of the memtable
+
+	uint64_t rowCacheSize = 0;		//bytes of values cached by key in front of the levels, 0 disables the row cache
+
+	uint64_t memoryBudget = 0;		//bytes of memtable, index tables and caches together, 0 means unlimited
+
+	std::shared_ptr<const mergeOperator> merger;		//folds operands written by KVStore::merge, none by default
+};
@@ -0,0 +1,53 @@
+#include "perfcontext.h"
+
+thread_local perfLevel currentPerfLevel = perfLevel::disabled;
+thread_local perfContext currentPerfContext;
+
+void perfContext::reset(){
+	*this = perfContext();
+}
+
+/**
+ * Return the nonzero counters as "name = value" separated by ", ".
+ */
+std::string perfContext::ToString() const{
+	std::string result;
+	auto append = [&result](const char *name, uint64_t value) {
+		if (value != 0) {
+			result += (result.empty() ? "" : ", ") + std::string(name) + " = " + std::to_string(value);
+		}
+	};
+
+	append("get_count", getCount);
+	append("memtable_hits", memTableHits);
+	append("memtable_misses", memTableMisses);
+	append("levels_searched", levelsSearched);
+	append("filter_checks", filterChecks);
+	append("filter_skips", filterSkips);
+	append("index_searches", indexSearches);
+	append("binary_searches", binarySearches);
+	append("cache_hits", cacheHits);
+	append("cache_misses", cacheMisses);
+	append("row_cache_hits", rowCacheHits);
+	append("row_cache_misses", rowCacheMisses);
+	append("file_opens", fileOpens);
+	append("bytes_read", bytesRead);
+	append("get_nanos", getNanos);
+	append("memtable_nanos", memTableNanos);
+	append("index_nanos", indexNanos);
+	append("value_nanos", valueNanos);
+	append("fold_nanos", foldNanos);
+	return result;
+}
+
+perfContext &perfContext::local(){
+	return currentPerfContext;
+}
+
+void perfContext::setLevel(perfLevel l){
+	currentPerfLevel = l;
+}
+
+perfLevel perfContext::level(){
+	return currentPerfLevel;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+//how much perfContext records on the calling thread
+enum class perfLevel{
+	disabled,		//nothing, the default
+	count,		//counters only
+	time		//counters and time in each stage
+};
+
+/**
+ * What the reads of the calling thread did since the last reset.
+ * Off by default, a thread turns it on with perfContext::setLevel, runs
+ * a request, reads perfContext::local() and resets it.
+ * Key range checks of SSTables play the part of filters.
+ */
+struct perfContext{
+	uint64_t getCount = 0;		//calls of KVStore::get
+	uint64_t memTableHits = 0, memTableMisses = 0;
+	uint64_t levelsSearched = 0;		//levels whose SSTables were searched for a key
+	uint64_t filterChecks = 0, filterSkips = 0;		//SSTables checked by key range, and skipped by it
+	uint64_t indexSearches = 0, binarySearches = 0;		//SSTable indexes searched, and binary searches over them
+	uint64_t cacheHits = 0, cacheMisses = 0;		//index partitions found in and missing from cache
+	uint64_t rowCacheHits = 0, rowCacheMisses = 0;		//values found in and missing from the row cache
+	uint64_t fileOpens = 0;		//SSTable, index and value log files opened or mapped
+	uint64_t bytesRead = 0;		//bytes of values and index partitions read
+	uint64_t getNanos = 0;		//whole KVStore::get
+	uint64_t memTableNanos = 0;		//memtable lookup, waiting for it included
+	uint64_t indexNanos = 0;		//search of SSTable indexes
+	uint64_t valueNanos = 0;		//reading values out of SSTables and value log
+	uint64_t foldNanos = 0;		//folding merge operands
+
+	void reset();		//zero all the counters
+
+	std::string ToString() const;		//"name = value" for every nonzero counter
+
+	static perfContext &local();		//context of the calling thread
+
+	static void setLevel(perfLevel l);		//level of the calling thread
+
+	static perfLevel level();
+};
+
+extern thread_local perfLevel currentPerfLevel;
+extern thread_local perfContext currentPerfContext;
+
+//add time in scope to a field of the calling thread's context, if the level is time
+class perfTimer{
+
+	uint64_t perfContext::*field;
+	std::chrono::steady_clock::time_point start;
+	bool running;
+
+	public:
+		perfTimer(uint64_t perfContext::*f):field(f),running(currentPerfLevel >= perfLevel::time){
+			if (running) {
+				start = std::chrono::steady_clock::now();
+			}
+		}
+
+		void stop(){		//add the time so far and stop
+			if (running) {
+				running = false;
+				currentPerfContext.*field += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+
+		~perfTimer(){
+			stop();
+		}
+
+		perfTimer(const perfTimer&) = delete;
+		perfTimer &operator=(const perfTimer&) = delete;
+};
+
+#define PERF_COUNT(counter, n) do { if (currentPerfLevel >= perfLevel::count) currentPerfContext.counter += (n); } while (0)
+#define PERF_TIMER(timer, field) perfTimer timer(&perfContext::field)
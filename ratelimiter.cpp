@@ -0,0 +1,90 @@
+#include "ratelimiter.h"
+#include <algorithm>
+
+static const std::chrono::milliseconds refillPeriod(100);		//tokens are refilled 10 times per second
+
+/**
+ * Create a limiter of l bytes per second, 0 means unlimited.
+ * An auto tuned limiter starts from the lower bound, as there is no
+ * backlog before the store reports one.
+ */
+rateLimiter::rateLimiter(uint64_t l, bool a):limit(l),rate(a ? std::max<uint64_t>(1, l / 20) : l),autoTune(a),available(0),nextRefill(clock::now()),total(0){}
+
+/**
+ * Block until bytes can be transferred.
+ * A request larger than one period is split, and is granted at once only
+ * if nobody is waiting ahead of it. Otherwise it waits in the queue of
+ * its priority, the first thread woken after the period ends refills
+ * the bucket for everyone.
+ */
+void rateLimiter::request(uint64_t bytes, priority p){
+	if (limit == 0) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mtx);
+	while (bytes > 0) {
+		uint64_t chunk = std::min(bytes, refillBytes());
+		bytes -= chunk;
+
+		if (queues[high].empty() && queues[low].empty() && available >= chunk) {
+			available -= chunk;
+			total += chunk;
+			continue;
+		}
+
+		ticket t{chunk, false};
+		queues[p].push_back(&t);
+		while (!t.granted) {
+			clock::time_point now = clock::now();
+			if (now >= nextRefill) {
+				refill(now);
+			}
+			else {
+				cond.wait_until(lock, nextRefill);
+			}
+		}
+	}
+}
+
+/**
+ * Start a new period with a full bucket.
+ * Requests are granted strictly in order, high priority first, so a
+ * large request is never starved by smaller ones behind it.
+ */
+void rateLimiter::refill(clock::time_point now){
+	available = refillBytes();
+	nextRefill = now + refillPeriod;
+
+	for (int p = high; p <= low; p++) {
+		//a request split before rate is lowered may exceed a whole bucket
+		while (!queues[p].empty() && (available >= queues[p].front()->bytes || available == refillBytes())) {
+			ticket *t = queues[p].front();
+			queues[p].pop_front();
+			available -= std::min(available, t->bytes);
+			total += t->bytes;
+			t->granted = true;
+		}
+		if (!queues[p].empty()) {
+			break;
+		}
+	}
+
+	cond.notify_all();
+}
+
+/**
+ * Set rate from the compaction backlog, linearly from limit/20 with no
+ * backlog up to limit once writes reach the hard limits, so compaction
+ * gets bandwidth as it falls behind and leaves the device to foreground
+ * reads otherwise. The new rate applies from the next period.
+ */
+void rateLimiter::tune(double backlog){
+	if (!autoTune || limit == 0) {
+		return;
+	}
+
+	backlog = std::min(1.0, std::max(0.0, backlog));
+	std::lock_guard<std::mutex> lock(mtx);
+	rate = std::max<uint64_t>(1, limit / 20 + (uint64_t)((limit - limit / 20) * backlog));
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+/**
+ * Token bucket limiting the background I/O of flush and compaction.
+ * Tokens are refilled every period, waiting requests are granted in
+ * order, flush before compaction. Foreground reads never go through it.
+ * With auto tuning the rate moves within [limit/20, limit] with the
+ * compaction backlog the store reports.
+ */
+class rateLimiter{
+
+	typedef std::chrono::steady_clock clock;
+
+	//a request waiting for tokens
+	struct ticket{
+		uint64_t bytes;
+		bool granted;
+	};
+
+	public:
+		enum priority{ high, low };		//flush is high, compaction is low
+
+	protected:
+		uint64_t limit;		//upper bound of rate in bytes per second, 0 means unlimited
+		uint64_t rate;		//current rate in bytes per second
+		bool autoTune;		//whether rate follows the backlog
+		uint64_t available;		//tokens left in this period
+		clock::time_point nextRefill;		//end of this period
+		std::deque<ticket*> queues[2];		//waiting requests of each priority
+		uint64_t total;		//bytes granted in all
+		std::mutex mtx;
+		std::condition_variable cond;
+
+		uint64_t refillBytes() const {		//tokens of one period
+			return std::max<uint64_t>(1, rate / 10);
+		}
+
+		void refill(clock::time_point now);		//start a new period and grant waiting requests
+
+	public:
+		rateLimiter(uint64_t l, bool a = false);
+
+		void request(uint64_t bytes, priority p);		//block until bytes can be transferred
+
+		void tune(double backlog);		//set rate by the backlog, 0 for none and 1 at the hard limits of writes
+
+		uint64_t Rate() {
+			std::lock_guard<std::mutex> lock(mtx);
+			return rate;
+		}
+
+		uint64_t Total() {
+			std::lock_guard<std::mutex> lock(mtx);
+			return total;
+		}
+};
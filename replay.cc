@@ -0,0 +1,114 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include "kvstore.h"
+
+/**
+ * Replay of a workload trace recorded by KVStore::startRecording.
+ * Usage: replay <trace> [dir] [--fast] [--force]
+ * Issues the traced operations against a fresh store in dir, keeping
+ * their original timing unless --fast is given. Values are filled up to
+ * their traced size and put with their traced ttl, merge operands are
+ * appended to the value. Reports the count and mean latency of each kind
+ * of operation.
+ * A dir holding anything is refused, unless --force is given to remove
+ * what it holds first.
+ */
+
+//merge operator of the replayed store, appends operand to the value
+class appendOperator : public mergeOperator{
+	public:
+		std::string merge(const std::string *existing, const std::string &operand) const override {
+			return existing == nullptr ? operand : *existing + operand;
+		}
+};
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: replay <trace> [dir] [--fast] [--force]" << std::endl;
+		return 1;
+	}
+
+	std::string dir = "data/replay";
+	bool fast = false, force = false;
+	for (int a = 2; a < argc; a++) {
+		if (std::string(argv[a]) == "--fast") {
+			fast = true;
+		}
+		else if (std::string(argv[a]) == "--force") {
+			force = true;
+		}
+		else {
+			dir = argv[a];
+		}
+	}
+
+	try {
+		workloadReader trace(argv[1]);
+		if (fs::exists(dir) && !fs::is_empty(dir)) {
+			if (!force) {
+				throw std::runtime_error(dir + " is not empty, pass --force to replay into it after removing its contents!");
+			}
+			fs::remove_all(dir);
+		}
+
+		options o;
+		o.merger = std::make_shared<appendOperator>();
+		KVStore store(dir, o);
+
+		const char *names[] = {"put", "get", "del", "merge", "scan"};
+		uint64_t counts[5] = {0}, found[5] = {0};
+		double micros[5] = {0};
+
+		workloadOp op;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while (trace.next(op)) {
+			if (op.op > workloadOp::scan) {
+				throw std::runtime_error("unknown operation in trace!");
+			}
+			if (!fast) {
+				std::this_thread::sleep_until(start + std::chrono::microseconds(op.micros));
+			}
+
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			switch (op.op) {
+				case workloadOp::put:
+					store.put(op.key, std::string(op.size, 'a' + op.key % 26), op.ttl);
+					break;
+				case workloadOp::get:
+					found[op.op] += !store.get(op.key).empty();
+					break;
+				case workloadOp::del:
+					found[op.op] += store.del(op.key);
+					break;
+				case workloadOp::merge:
+					store.merge(op.key, std::string(op.size, 'a' + op.key % 26));
+					break;
+				case workloadOp::scan:
+					found[op.op] += store.scan(op.key, op.max).size();
+					break;
+			}
+			micros[op.op] += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+			counts[op.op]++;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		uint64_t total = 0;
+		for (int t = 0; t < 5; t++) {
+			total += counts[t];
+			if (counts[t] != 0) {
+				std::cout << names[t] << ": " << counts[t] << " ops, " << micros[t] / counts[t] << "us each";
+				if (t != workloadOp::put && t != workloadOp::merge) {
+					std::cout << ", " << found[t] << (t == workloadOp::scan ? " pairs" : " found");
+				}
+				std::cout << std::endl;
+			}
+		}
+		std::cout << total << " ops in " << seconds << "s, " << total / seconds << " ops/s" << std::endl;
+	}catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
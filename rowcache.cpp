@@ -0,0 +1,139 @@
+#include "rowcache.h"
+#include <ctime>
+#include <algorithm>
+
+/**
+ * Create an empty cache of at most c bytes, with a sketch of about one
+ * counter per 256 bytes in each row.
+ */
+rowCache::rowCache(uint64_t c):capacity(c),usage(0),width(1024),additions(0),erased(stripes, 0){
+	while (width < c / 256) {
+		width *= 2;
+	}
+	sketch.assign(depth * width, 0);
+}
+
+//splitmix64 of key, seeded by row
+uint64_t rowCache::hash(uint64_t key, unsigned row){
+	uint64_t z = key + (row + 1) * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+uint8_t rowCache::frequency(uint64_t key) const{
+	uint8_t result = 15;
+	for (unsigned row = 0; row < depth; row++) {
+		result = std::min(result, sketch[row * width + (hash(key, row) & (width - 1))]);
+	}
+	return result;
+}
+
+void rowCache::increment(uint64_t key){
+	for (unsigned row = 0; row < depth; row++) {
+		uint8_t &counter = sketch[row * width + (hash(key, row) & (width - 1))];
+		if (counter < 15) {
+			counter++;
+		}
+	}
+
+	if (++additions >= 10 * width) {
+		for (std::vector<uint8_t>::iterator counter = sketch.begin(); counter != sketch.end(); counter++) {
+			*counter /= 2;
+		}
+		additions /= 2;
+	}
+}
+
+void rowCache::drop(Iter position){
+	usage -= position->charge;
+	positions.erase(position->key);
+	entries.erase(position);
+}
+
+void rowCache::evict(){
+	while (usage > capacity && !entries.empty()) {
+		drop(--entries.end());
+	}
+}
+
+uint64_t rowCache::ticket(uint64_t key){
+	std::lock_guard<std::mutex> lock(mtx);
+	return erased[key % stripes];
+}
+
+/**
+ * Count a read of key and return its value, refreshing it.
+ * Return nullptr if key is not cached or its pair has expired.
+ */
+std::shared_ptr<const std::string> rowCache::find(uint64_t key){
+	std::lock_guard<std::mutex> lock(mtx);
+	increment(key);
+
+	std::unordered_map<uint64_t, Iter>::iterator position = positions.find(key);
+	if (position == positions.end()) {
+		return nullptr;
+	}
+	if (position->second->expire != 0 && position->second->expire <= (uint64_t)time(nullptr)) {
+		drop(position->second);
+		return nullptr;
+	}
+
+	entries.splice(entries.begin(), entries, position->second);
+	return position->second->value;
+}
+
+/**
+ * Cache the value of key read from levels under ticket t.
+ * It is refused if key has been erased since the ticket was taken, or
+ * the cache is full and key is read no more often than the least
+ * recently used key, which would be evicted first.
+ */
+void rowCache::insert(uint64_t key, std::string_view value, uint64_t expire, uint64_t t){
+	uint64_t charge = value.size() + overhead;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	if (erased[key % stripes] != t || charge > capacity || positions.find(key) != positions.end()) {
+		return;
+	}
+	if (usage + charge > capacity && frequency(key) <= frequency(entries.back().key)) {
+		return;
+	}
+
+	entries.push_front(entry{key, std::make_shared<const std::string>(value), expire, charge});
+	positions[key] = entries.begin();
+	usage += charge;
+	evict();
+}
+
+void rowCache::erase(uint64_t key){
+	std::lock_guard<std::mutex> lock(mtx);
+	erased[key % stripes]++;
+
+	std::unordered_map<uint64_t, Iter>::iterator position = positions.find(key);
+	if (position != positions.end()) {
+		drop(position->second);
+	}
+}
+
+//every stripe counts as erased, so no insert under an older ticket gets in
+void rowCache::clear(){
+	std::lock_guard<std::mutex> lock(mtx);
+	for (std::vector<uint64_t>::iterator stripe = erased.begin(); stripe != erased.end(); stripe++) {
+		(*stripe)++;
+	}
+	entries.clear();
+	positions.clear();
+	usage = 0;
+}
+
+void rowCache::setCapacity(uint64_t c){
+	std::lock_guard<std::mutex> lock(mtx);
+	capacity = c;
+	evict();
+}
+
+uint64_t rowCache::Usage(){
+	std::lock_guard<std::mutex> lock(mtx);
+	return usage;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+/**
+ * Cache of values by key, consulted by KVStore::get between memtable and
+ * levels. Entries are evicted least recently used first, within a bound
+ * of bytes.
+ * A new entry is admitted into a full cache only if its key is read more
+ * often than the key it would evict (TinyLFU). Read frequencies are
+ * estimated by a count-min sketch that is halved periodically, so keys
+ * read once, as by a long run of cold gets, cannot push out hot ones.
+ * Writers erase keys they change. A reader takes a ticket before looking
+ * the key up, and its insert is dropped if the key has been erased
+ * since, so a value read from levels never overwrites a newer write.
+ */
+class rowCache{
+
+	//a cached value
+	struct entry{
+		uint64_t key;
+		std::shared_ptr<const std::string> value;
+		uint64_t expire;		//wall clock second the pair expires at, 0 if never
+		uint64_t charge;
+	};
+
+	typedef std::list<entry>::iterator Iter;
+
+	static const unsigned depth = 4;		//rows of the sketch
+	static const uint64_t stripes = 1024;		//erase counters, keys share them by hash
+
+	std::mutex mtx;
+	uint64_t capacity;
+	uint64_t usage;
+	std::list<entry> entries;		//most recently used first
+	std::unordered_map<uint64_t, Iter> positions;		//position of each key in entries
+	std::vector<uint8_t> sketch;		//depth rows of counters saturating at 15
+	uint64_t width;		//counters per row, a power of 2
+	uint64_t additions;		//increments since the last halving
+	std::vector<uint64_t> erased;		//erases per stripe
+
+	static uint64_t hash(uint64_t key, unsigned row);
+
+	uint8_t frequency(uint64_t key) const;		//estimated reads of key
+
+	void increment(uint64_t key);		//count a read of key, halve all counters once they hold 10 * width reads
+
+	void drop(Iter position);		//remove an entry
+
+	void evict();		//evict until usage fits capacity
+
+	public:
+		static const uint64_t overhead = 128;		//bytes charged per entry besides the value
+
+		rowCache(uint64_t c);
+
+		rowCache(const rowCache&) = delete;
+		rowCache &operator=(const rowCache&) = delete;
+
+		uint64_t ticket(uint64_t key);		//taken before looking key up, handed to insert
+
+		std::shared_ptr<const std::string> find(uint64_t key);		//count a read and look up key, nullptr if missing or expired
+
+		void insert(uint64_t key, std::string_view value, uint64_t expire, uint64_t t);		//cache value read under ticket t, if admitted
+
+		void erase(uint64_t key);		//drop key, inserts under older tickets are refused
+
+		void clear();		//drop all the keys
+
+		void setCapacity(uint64_t c);		//resize, evicting until usage fits
+
+		uint64_t Usage();		//bytes charged
+};
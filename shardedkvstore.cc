@@ -0,0 +1,135 @@
+#include "shardedkvstore.h"
+#include <algorithm>
+
+/**
+ * Hash partition: spread keys over n shards by a mixed hash of the key,
+ * so that dense key ranges do not land on the same shard.
+ */
+ShardedKVStore::ShardedKVStore(const std::string &dir, unsigned n, const options &o): KVStoreAPI(dir){
+	open(dir, n, o);
+}
+
+/**
+ * Range partition: shard i holds the keys in [b[i-1], b[i]), the last
+ * shard holds all the keys not smaller than b.back().
+ */
+ShardedKVStore::ShardedKVStore(const std::string &dir, const std::vector<uint64_t> &b, const options &o): KVStoreAPI(dir),boundaries(b){
+	std::sort(boundaries.begin(), boundaries.end());
+	open(dir, boundaries.size() + 1, o);
+}
+
+ShardedKVStore::~ShardedKVStore(){}
+
+/**
+ * Open n shards under dir, each in its own sub-directory.
+ * The partition is recorded on first open, and reopening with another
+ * partition fails since keys would be looked up in wrong shards.
+ */
+void ShardedKVStore::open(const std::string &dir, unsigned n, const options &o){
+	try{
+		fs::path storage(dir);
+		if (!fs::exists(storage) && !fs::create_directory(storage)) {
+			throw std::runtime_error("the creation of dir has failed!");
+		}
+
+		std::string layout = (boundaries.empty() ? "hash " : "range ") + std::to_string(n);
+		for (std::vector<uint64_t>::iterator iter = boundaries.begin(); iter != boundaries.end(); iter++) {
+			layout += " " + std::to_string(*iter);
+		}
+
+		fs::path layoutPath = storage / "shards";
+		if (fs::exists(layoutPath)) {
+			std::ifstream inFile(layoutPath.string(), std::ios::in);
+			std::string recorded;
+			std::getline(inFile, recorded);
+			if (recorded != layout) {
+				throw std::runtime_error("the store was created with another partition: " + recorded);
+			}
+		}
+		else {
+			std::ofstream outFile(layoutPath.string(), std::ios::out);
+			outFile << layout << std::endl;
+		}
+
+		options shardOption = o;		//shards share the cores and the I/O budget for compaction
+		shardOption.compactionThreads = std::max(1u, o.compactionThreads / n);
+		shardOption.ioRateLimit = o.ioRateLimit == 0 ? 0 : std::max<uint64_t>(1, o.ioRateLimit / n);
+
+		for (unsigned i = 0; i < n; i++) {
+			shards.push_back(std::make_unique<KVStore>((storage / ("shard" + std::to_string(i))).string(), shardOption));
+		}
+	}catch(const std::exception &e){
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+}
+
+/**
+ * Find the shard holding key.
+ */
+KVStore &ShardedKVStore::shardOf(uint64_t key){
+	if (!boundaries.empty()) {
+		return *shards[std::upper_bound(boundaries.begin(), boundaries.end(), key) - boundaries.begin()];
+	}
+
+	//finalizer of splitmix64
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+	key = key ^ (key >> 31);
+	return *shards[key % shards.size()];
+}
+
+/**
+ * Insert/Update the key-value pair.
+ * No return values for simplicity.
+ */
+void ShardedKVStore::put(uint64_t key, const std::string &s){
+	shardOf(key).put(key, s);
+}
+
+/**
+ * Insert/Update the key-value pair expiring ttl seconds later.
+ */
+void ShardedKVStore::put(uint64_t key, const std::string &s, uint64_t ttl){
+	shardOf(key).put(key, s, ttl);
+}
+
+/**
+ * Returns the (string) value of the given key.
+ * An empty string indicates not found.
+ */
+std::string ShardedKVStore::get(uint64_t key){
+	return shardOf(key).get(key);
+}
+
+/**
+ * Pins the value of the given key.
+ * Returns false iff the key is not found.
+ */
+bool ShardedKVStore::get(uint64_t key, pinnedSlice &value){
+	return shardOf(key).get(key, value);
+}
+
+/**
+ * Apply operand to the value of the given key without reading it.
+ */
+void ShardedKVStore::merge(uint64_t key, const std::string &operand){
+	shardOf(key).merge(key, operand);
+}
+
+/**
+ * Delete the given key-value pair if it exists.
+ * Returns false iff the key is not found.
+ */
+bool ShardedKVStore::del(uint64_t key){
+	return shardOf(key).del(key);
+}
+
+/**
+ * This resets all the shards.
+ */
+void ShardedKVStore::reset(){
+	for (std::vector<std::unique_ptr<KVStore>>::iterator iter = shards.begin(); iter != shards.end(); iter++) {
+		(*iter)->reset();
+	}
+}
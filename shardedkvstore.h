@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "kvstore.h"
+
+/**
+ * KVStore partitioning the key space over independent shards.
+ * Every shard is a KVStore with its own directory, memtable and levels,
+ * serializing its own writes, so writes to different shards run in
+ * parallel. Keys are spread by hash, or by range if boundaries are given.
+ */
+class ShardedKVStore : public KVStoreAPI{
+
+	private:
+		std::vector<std::unique_ptr<KVStore>> shards;
+		std::vector<uint64_t> boundaries;		//shard i holds keys below boundaries[i], empty for hash partition
+
+		KVStore &shardOf(uint64_t key);		//the shard holding key
+
+		void open(const std::string &dir, unsigned n, const options &o);		//open all the shards under dir
+
+	public:
+		ShardedKVStore(const std::string &dir, unsigned n, const options &o = options());		//hash partition over n shards
+
+		ShardedKVStore(const std::string &dir, const std::vector<uint64_t> &b, const options &o = options());		//range partition at boundaries b
+
+		~ShardedKVStore();
+
+		void put(uint64_t key, const std::string &s) override;
+
+		void put(uint64_t key, const std::string &s, uint64_t ttl);		//the pair expires ttl seconds later, 0 for never
+
+		std::string get(uint64_t key) override;
+
+		bool get(uint64_t key, pinnedSlice &value);		//pin the value instead of copying it, return false iff not found
+
+		bool del(uint64_t key) override;
+
+		void merge(uint64_t key, const std::string &operand);		//apply operand to the value through the registered merge operator
+
+		void reset() override;
+};
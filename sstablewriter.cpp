@@ -0,0 +1,62 @@
+#include "sstablewriter.h"
+
+/**
+ * Create the data file at p and its index file.
+ * If fail to create them, throw run_time error.
+ */
+SSTableWriter::SSTableWriter(const fs::path &p):path(p),offset(0),count(0),last(0),finished(false){
+	data.open(path.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+	indexes.open(indexPath(path).string(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!data || !indexes) {
+		throw std::runtime_error("fail to create " + path.string() + "!");
+	}
+	writeIndexHeader(indexes);
+}
+
+//a writer not finished is closed, call finish to learn about failures
+SSTableWriter::~SSTableWriter(){
+	try {
+		finish();
+	}catch (const std::exception &e) {
+	}
+}
+
+/**
+ * Append a pair, stored like SSTables written by flush.
+ * If the key is not larger than the last one, or the writer is finished,
+ * throw run_time error.
+ */
+void SSTableWriter::add(uint64_t key, const std::string &value){
+	if (finished) {
+		throw std::runtime_error("add to a finished SSTable!");
+	}
+	if (count != 0 && key <= last) {
+		throw std::runtime_error("keys of SSTable must be added in increasing order!");
+	}
+
+	uint64_t size = value.size() + 1;
+	index i = index(key, offset, size, 0, 0);
+	data.write(value.c_str(), size);
+	indexes.write((char*)&i, sizeof(i));
+
+	offset += size;
+	last = key;
+	count++;
+}
+
+/**
+ * Close both files, further pairs are refused.
+ * If fail to write them, throw run_time error.
+ */
+void SSTableWriter::finish(){
+	if (finished) {
+		return;
+	}
+
+	finished = true;
+	data.close();
+	indexes.close();
+	if (data.fail() || indexes.fail()) {
+		throw std::runtime_error("fail to write " + path.string() + "!");
+	}
+}
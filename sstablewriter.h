@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include "level.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * Builder of a SSTable outside of any KVStore, to be taken over by
+ * KVStore::ingestFiles without rewriting.
+ * Pairs are added in increasing order of key. The values are written to
+ * the file at path, and their indexs to the file beside it named by
+ * indexPath. Values are never separated into the value log.
+ */
+class SSTableWriter{
+
+	protected:
+		fs::path path;		//path of the data file
+		std::ofstream data, indexes;
+		uint64_t offset;		//bytes of values written
+		uint64_t count;		//number of pairs written
+		uint64_t last;		//key of the last pair
+		bool finished;
+
+	public:
+		SSTableWriter(const fs::path &p);
+
+		~SSTableWriter();
+
+		SSTableWriter(const SSTableWriter&) = delete;
+		SSTableWriter &operator=(const SSTableWriter&) = delete;
+
+		void add(uint64_t key, const std::string &value);		//append a pair, key must be larger than the last one
+
+		void finish();		//flush and close both files
+
+		uint64_t Count() const {
+			return count;
+		}
+
+		static fs::path indexPath(const fs::path &p){		//index file of the SSTable at p
+			fs::path result = p;
+			result += ".index";
+			return result;
+		}
+};
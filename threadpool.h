@@ -0,0 +1,96 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+
+/**********************************************************************
+ * threadPool
+ * fixed number of workers taking tasks from a shared queue, the result
+ * (or exception) of each task is delivered through a future
+ * *******************************************************************/
+class threadPool{
+
+    public:
+        threadPool(unsigned n);         //start n workers
+        threadPool(const threadPool&) = delete;
+        threadPool &operator=(const threadPool&) = delete;
+        ~threadPool();                  //finish queued tasks and join workers
+        unsigned size() const{          //the number of workers
+            return workers.size();
+        }
+        template<typename func>
+        auto submit(const func &f) -> std::future<decltype(f())>;      //run f on a worker
+
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex mtx;
+        std::condition_variable cond;
+        bool stop;
+
+        void work();        //loop of each worker
+};
+
+//definition of constructor
+inline threadPool::threadPool(unsigned n):stop(false){
+    for(unsigned i = 0; i < n; i++){
+        workers.emplace_back(&threadPool::work, this);
+    }
+}
+
+//definition of destructor
+inline threadPool::~threadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cond.notify_all();
+
+    for(std::vector<std::thread>::iterator iter = workers.begin(); iter != workers.end(); iter++){
+        iter->join();
+    }
+}
+
+//definition of work
+inline void threadPool::work(){
+    while(true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cond.wait(lock, [this]{ return stop || !tasks.empty(); });
+            if(stop && tasks.empty()){
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+/*************************************************************************
+ * Submit operation for threadPool
+ * Wrap f into a packaged task so that its result and exception
+ * can be taken from the returned future
+ ************************************************************************/
+template<typename func>
+auto threadPool::submit(const func &f) -> std::future<decltype(f())>{
+    std::shared_ptr<std::packaged_task<decltype(f())()>> task = std::make_shared<std::packaged_task<decltype(f())()>>(f);
+    std::future<decltype(f())> result = task->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        tasks.push([task]{ (*task)(); });
+    }
+    cond.notify_one();
+
+    return result;
+}
+
+#endif
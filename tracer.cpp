@@ -0,0 +1,90 @@
+#include "tracer.h"
+#include <fstream>
+#include <memory>
+#include <atomic>
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+static std::mutex registryMutex;		//guard buffers
+static std::vector<std::shared_ptr<void>> buffers;		//buffers of all the threads ever traced, kept after they exit
+static std::atomic<uint64_t> nextTid(1);
+
+uint64_t tracer::now(){
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+/**
+ * Return the buffer of the calling thread, registering it on first use.
+ */
+tracer::buffer &tracer::local(){
+	thread_local std::shared_ptr<buffer> mine;
+	if (mine == nullptr) {
+		mine = std::make_shared<buffer>();
+		mine->events.resize(capacity);
+		mine->next = 0;
+		mine->tid = nextTid++;
+
+		std::lock_guard<std::mutex> lock(registryMutex);
+		buffers.push_back(mine);
+	}
+	return *mine;
+}
+
+/**
+ * Record a finished span, overwriting the oldest one of the thread if
+ * its buffer is full.
+ */
+void tracer::record(const traceEvent &e){
+	buffer &b = local();
+	std::lock_guard<std::mutex> lock(b.mtx);
+	b.events[b.next % capacity] = e;
+	b.next++;
+}
+
+/**
+ * Write the spans of every thread into path as complete events of the
+ * Chrome trace format, loadable by chrome://tracing or Perfetto.
+ * Return false if fail to open path.
+ */
+bool tracer::dump(const std::string &path){
+	std::ofstream outFile(path, std::ios::out | std::ios::trunc);
+	if (!outFile) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> registryLock(registryMutex);
+	outFile << "{\"traceEvents\":[";
+	bool first = true;
+	for (std::vector<std::shared_ptr<void>>::iterator iter = buffers.begin(); iter != buffers.end(); iter++) {
+		buffer &b = *std::static_pointer_cast<buffer>(*iter);
+		std::lock_guard<std::mutex> lock(b.mtx);
+		for (uint64_t n = b.next > capacity ? b.next - capacity : 0; n < b.next; n++) {
+			const traceEvent &e = b.events[n % capacity];
+			outFile << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b.tid << ",\"ts\":" << e.start << ",\"dur\":" << e.duration << ",\"args\":{";
+
+			bool firstArg = true;
+			const char *names[] = {"level", "tables", "bytes"};
+			int64_t values[] = {e.level, e.tables, e.bytes};
+			for (int a = 0; a < 3; a++) {
+				if (values[a] >= 0) {
+					outFile << (firstArg ? "" : ",") << "\"" << names[a] << "\":" << values[a];
+					firstArg = false;
+				}
+			}
+			outFile << "}}";
+			first = false;
+		}
+	}
+	outFile << "\n]}\n";
+
+	return (bool)outFile;
+}
+
+void tracer::clear(){
+	std::lock_guard<std::mutex> registryLock(registryMutex);
+	for (std::vector<std::shared_ptr<void>>::iterator iter = buffers.begin(); iter != buffers.end(); iter++) {
+		buffer &b = *std::static_pointer_cast<buffer>(*iter);
+		std::lock_guard<std::mutex> lock(b.mtx);
+		b.next = 0;
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+//a finished span, args are -1 if not recorded
+struct traceEvent{
+	const char *name;
+	uint64_t start, duration;		//microseconds since the process started
+	int64_t level, tables, bytes;
+};
+
+/**
+ * Trace of spans kept in a ring buffer per thread, dumped as Chrome
+ * trace JSON on demand. Recording only takes the lock of the thread's
+ * own buffer, which is contended by dump alone.
+ * Compiled out with -DDISABLE_TRACE, which leaves the TRACE_ macros
+ * empty.
+ */
+class tracer{
+
+	//ring buffer of the spans finished by one thread
+	struct buffer{
+		std::mutex mtx;
+		std::vector<traceEvent> events;
+		uint64_t next;		//number of spans ever recorded
+		uint64_t tid;
+	};
+
+	static buffer &local();		//buffer of the calling thread
+
+	public:
+		static const uint64_t capacity = 8192;		//spans kept per thread
+
+		static uint64_t now();		//microseconds since the process started
+
+		static void record(const traceEvent &e);
+
+		static bool dump(const std::string &path);		//write all the buffers as Chrome trace JSON, false if fail to open path
+
+		static void clear();		//drop all the spans
+};
+
+/**
+ * Span recorded when it ends or goes out of scope, unless it is shorter
+ * than minMicros. Args are set by the owner while the span is open.
+ */
+class traceSpan{
+
+	traceEvent event;
+	uint64_t minMicros;
+	bool open;
+
+	public:
+		int64_t &level, &tables, &bytes;
+
+		traceSpan(const char *name, int64_t l = -1, uint64_t m = 0):minMicros(m),open(true),level(event.level),tables(event.tables),bytes(event.bytes){
+			event.name = name;
+			event.start = tracer::now();
+			event.level = l;
+			event.tables = -1;
+			event.bytes = -1;
+		}
+
+		void end(){		//record the span now instead of at the end of scope
+			if (open) {
+				open = false;
+				event.duration = tracer::now() - event.start;
+				if (event.duration >= minMicros) {
+					tracer::record(event);
+				}
+			}
+		}
+
+		~traceSpan(){
+			end();
+		}
+
+		traceSpan(const traceSpan&) = delete;
+		traceSpan &operator=(const traceSpan&) = delete;
+};
+
+#ifndef DISABLE_TRACE
+#define TRACE_SPAN(span, ...) traceSpan span(__VA_ARGS__)
+#define TRACE_ARG(span, arg, value) (span.arg = (value))
+#define TRACE_SPAN_END(span) span.end()
+#else
+#define TRACE_SPAN(span, ...)
+#define TRACE_ARG(span, arg, value)
+#define TRACE_SPAN_END(span)
+#endif
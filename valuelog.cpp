@@ -0,0 +1,154 @@
+#include "valuelog.h"
+#include "perfcontext.h"
+
+/**
+ * Open the value log under p.
+ * Restore live statistic of existing files and start a new active file,
+ * so a torn tail left by a crash is never appended to.
+ */
+valueLog::valueLog(const fs::path &p, uint64_t m):logPath(p),maxFileSize(m),active(0),activeSize(0){
+	if (!fs::exists(logPath) && !fs::create_directory(logPath)) {
+		throw std::runtime_error("the creation of dir has failed!");
+	}
+
+	std::ifstream inFile((logPath / "stats").string(), std::ios::in);
+	uint32_t file;
+	stat s;
+	while (inFile >> file >> s.total >> s.live) {
+		if (fs::exists(filePath(file))) {
+			stats[file] = s;
+		}
+	}
+	inFile.close();
+
+	for (auto &iter : fs::directory_iterator(logPath)) {
+		if (iter.path().extension() == ".vlog") {
+			uint32_t number = std::stoul(iter.path().stem().string());
+			if (number > active) {
+				active = number;
+			}
+		}
+	}
+
+	openActive();
+}
+
+valueLog::~valueLog(){
+	sync();
+}
+
+/**
+ * Close the current active file and open the next one.
+ */
+void valueLog::openActive(){
+	if (outFile.is_open()) {
+		outFile.close();
+	}
+
+	active++;
+	activeSize = 0;
+	stats[active] = stat{0, 0};
+	outFile.open(filePath(active).string(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!outFile) {
+		throw std::runtime_error("fail to open value log!");
+	}
+}
+
+/**
+ * Append a value to the active file.
+ * Return the file and the offset of the value part through file and offset.
+ */
+void valueLog::append(uint64_t key, const std::string &value, uint32_t &file, uint64_t &offset){
+	std::lock_guard<std::mutex> lock(mtx);
+	if (activeSize >= maxFileSize) {
+		openActive();
+	}
+
+	uint64_t size = value.size();
+	outFile.write((char*)&key, sizeof(key));
+	outFile.write((char*)&size, sizeof(size));
+	outFile.write(value.data(), size);
+
+	file = active;
+	offset = activeSize + sizeof(key) + sizeof(size);
+	activeSize = offset + size;
+	stats[active].total += size;
+	stats[active].live += size;
+}
+
+/**
+ * Read a value from the log.
+ * A collected file only backs shadowed entries, so a missing file reads
+ * as not found, reported through found if given.
+ */
+std::string valueLog::read(uint32_t file, uint64_t offset, uint64_t size, bool *found) const{
+	std::ifstream inFile(filePath(file).string(), std::ios::in | std::ios::binary);
+	if (found != nullptr) {
+		*found = (bool)inFile;
+	}
+	if (!inFile) {
+		return "";
+	}
+	PERF_COUNT(fileOpens, 1);
+	PERF_COUNT(bytesRead, size);
+
+	std::string value(size, '\0');
+	inFile.seekg(offset, std::ios::beg);
+	inFile.read(&value[0], size);
+
+	inFile.close();
+	return value;
+}
+
+/**
+ * Called by compaction when it drops an entry pointing into the log.
+ */
+void valueLog::discard(uint32_t file, uint64_t size){
+	std::lock_guard<std::mutex> lock(mtx);
+	std::map<uint32_t, stat>::iterator iter = stats.find(file);
+	if (iter != stats.end()) {
+		iter->second.live -= std::min(size, iter->second.live);
+	}
+}
+
+/**
+ * Return all the sealed files whose live ratio is below ratio.
+ */
+std::vector<uint32_t> valueLog::garbageFiles(double ratio) const{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<uint32_t> result;
+
+	for (std::map<uint32_t, stat>::const_iterator iter = stats.begin(); iter != stats.end(); iter++) {
+		if (iter->first != active && (iter->second.live == 0 || iter->second.live < iter->second.total * ratio)) {
+			result.push_back(iter->first);
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Remove a file after its live values have been written back.
+ */
+void valueLog::drop(uint32_t file){
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stats.erase(file);
+		fs::remove(filePath(file));
+	}
+	sync();
+}
+
+/**
+ * Flush the active file so that its values are readable, and persist
+ * live statistic of all files.
+ */
+void valueLog::sync(){
+	std::lock_guard<std::mutex> lock(mtx);
+	outFile.flush();
+
+	std::ofstream statFile((logPath / "stats").string(), std::ios::out | std::ios::trunc);
+	for (std::map<uint32_t, stat>::const_iterator iter = stats.begin(); iter != stats.end(); iter++) {
+		statFile << iter->first << " " << iter->second.total << " " << iter->second.live << std::endl;
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+namespace fs = std::filesystem;
+
+/**
+ * Append-only log holding the large values separated from SSTables.
+ * Each record is laid out as [key][size][value], the SSTable index only
+ * keeps (file, offset, size) of the value part.
+ */
+class valueLog{
+
+	//live statistic of a log file
+	struct stat{
+		uint64_t total, live;
+	};
+
+	protected:
+		const fs::path logPath;		//directory of log files
+		uint64_t maxFileSize;		//switch to a new log file beyond this size
+		uint32_t active;		//number of the file being appended
+		uint64_t activeSize;		//current size of the active file
+		std::map<uint32_t, stat> stats;		//live statistic of every log file
+		std::ofstream outFile;		//append stream of the active file
+		mutable std::mutex mtx;		//flush and background compaction update the log at the same time
+
+		void openActive();		//open a new active file
+
+	public:
+		valueLog(const fs::path &p, uint64_t m);
+
+		~valueLog();
+
+		void append(uint64_t key, const std::string &value, uint32_t &file, uint64_t &offset);		//append value, return its position
+
+		std::string read(uint32_t file, uint64_t offset, uint64_t size, bool *found = nullptr) const;		//read value at the position
+
+		fs::path filePath(uint32_t file) const {		//path of a log file
+			return logPath / (std::to_string(file) + ".vlog");
+		}
+
+		void discard(uint32_t file, uint64_t size);		//a value in the file becomes garbage
+
+		std::vector<uint32_t> garbageFiles(double ratio) const;		//files whose live ratio is below ratio
+
+		void drop(uint32_t file);		//remove a collected file
+
+		void sync();		//flush active file and persist statistic
+
+		template<typename func>
+		void scan(uint32_t file, const func &f) const;		//visit every record of the file
+};
+
+/**
+ * Visit every record of a log file in order.
+ * f is called with (key, offset of value, value).
+ */
+template<typename func>
+void valueLog::scan(uint32_t file, const func &f) const{
+	std::ifstream inFile(filePath(file).string(), std::ios::in | std::ios::binary);
+	uint64_t offset = 0, key, size;
+
+	while (inFile.read((char*)&key, sizeof(key)) && inFile.read((char*)&size, sizeof(size))) {
+		std::string value(size, '\0');
+		if (!inFile.read(&value[0], size)) {		//torn record at the tail
+			break;
+		}
+		offset += sizeof(key) + sizeof(size);
+		f(key, offset, value);
+		offset += size;
+	}
+}
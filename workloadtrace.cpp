@@ -0,0 +1,77 @@
+#include "workloadtrace.h"
+#include <stdexcept>
+#include <cstring>
+
+const char workloadRecorder::magic[8] = {'L', 'S', 'M', 'T', 'R', 'C', '0', '3'};
+
+/**
+ * Create the trace file at path, timestamps count from now.
+ * If fail to create it, throw run_time error.
+ */
+workloadRecorder::workloadRecorder(const std::string &path):outFile(path, std::ios::out | std::ios::binary | std::ios::trunc),start(std::chrono::steady_clock::now()){
+	if (!outFile) {
+		throw std::runtime_error("fail to create trace " + path + "!");
+	}
+	outFile.write(magic, sizeof(magic));
+}
+
+/**
+ * Append an operation as 41 bytes: time, type, key, max, size and ttl.
+ */
+void workloadRecorder::add(workloadOp::type op, uint64_t key, uint64_t size, uint64_t ttl, uint64_t max){
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	outFile.write((char*)&micros, sizeof(micros));
+	outFile.write((char*)&op, sizeof(op));
+	outFile.write((char*)&key, sizeof(key));
+	outFile.write((char*)&max, sizeof(max));
+	outFile.write((char*)&size, sizeof(size));
+	outFile.write((char*)&ttl, sizeof(ttl));
+}
+
+/**
+ * Close the file.
+ * If fail to write it, throw run_time error.
+ */
+void workloadRecorder::finish(){
+	outFile.close();
+	if (outFile.fail()) {
+		throw std::runtime_error("fail to write trace!");
+	}
+}
+
+/**
+ * Open the trace file at path.
+ * If fail to open it or it is not a trace, throw run_time error.
+ */
+workloadReader::workloadReader(const std::string &path):inFile(path, std::ios::in | std::ios::binary),version('3'){
+	char head[sizeof(workloadRecorder::magic)];
+	const size_t versioned = sizeof(head) - 1;		//bytes before the version
+	if (!inFile.read(head, sizeof(head)) || memcmp(head, workloadRecorder::magic, versioned) != 0 || head[versioned] < '1' || head[versioned] > '3') {
+		throw std::runtime_error("fail to open trace " + path + "!");
+	}
+	version = head[versioned];
+}
+
+/**
+ * Read the next operation into result.
+ * Return false at the end of the trace, a record cut short included.
+ */
+bool workloadReader::next(workloadOp &result){
+	inFile.read((char*)&result.micros, sizeof(result.micros));
+	inFile.read((char*)&result.op, sizeof(result.op));
+	inFile.read((char*)&result.key, sizeof(result.key));
+	result.max = 0;
+	if (version >= '3') {
+		inFile.read((char*)&result.max, sizeof(result.max));
+	}
+	inFile.read((char*)&result.size, sizeof(result.size));
+	result.ttl = 0;
+	if (version >= '2') {
+		inFile.read((char*)&result.ttl, sizeof(result.ttl));
+	}
+	if (version < '3' && result.op == workloadOp::scan) {		//max of the scan was kept in size
+		result.max = result.size;
+		result.size = 0;
+	}
+	return (bool)inFile;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+//an operation issued to a KVStore, as recorded in a workload trace
+struct workloadOp{
+	enum type : uint8_t { put, get, del, merge, scan };
+
+	uint64_t micros;		//time since recording started
+	type op;
+	uint64_t key;		//min of a scan
+	uint64_t max;		//max of a scan, 0 otherwise
+	uint64_t size;		//value size of put and merge, 0 otherwise
+	uint64_t ttl;		//seconds a put lives, 0 for never and for other operations
+};
+
+/**
+ * Writer of a workload trace file.
+ * The file starts with a magic string and holds one fixed size record
+ * per operation. Values are not kept, only their size. The last byte of
+ * the magic string is the version of the record layout.
+ * Not thread safe, KVStore serializes the calls.
+ */
+class workloadRecorder{
+
+	std::ofstream outFile;
+	std::chrono::steady_clock::time_point start;
+
+	public:
+		static const char magic[8];
+
+		workloadRecorder(const std::string &path);
+
+		void add(workloadOp::type op, uint64_t key, uint64_t size, uint64_t ttl = 0, uint64_t max = 0);
+
+		void finish();		//flush and close the file
+};
+
+/**
+ * Reader of a workload trace file, operations come back in the order
+ * they were recorded. Traces of the first version, recorded without
+ * ttl, read as puts living forever. Traces before the third version
+ * kept the max of a scan in its size, it reads back as max.
+ */
+class workloadReader{
+
+	std::ifstream inFile;
+	char version;		//version of the record layout, '1' to '3'
+
+	public:
+		workloadReader(const std::string &path);
+
+		bool next(workloadOp &result);		//read the next operation, false at the end of the trace
+};